@@ -0,0 +1,183 @@
+#pragma once
+#include "common.h"
+#include "json.hpp"
+
+// Monotonic arena: bump allocation out of large blocks, released all at once by reset().
+// Blocks are kept across resets so a warmed-up arena does no heap allocation at all.
+class monotonic_arena {
+public:
+    explicit monotonic_arena(std::size_t block_size = 64 * 1024)
+        : block_size_(block_size)
+    {
+    }
+
+    monotonic_arena(const monotonic_arena&) = delete;
+    monotonic_arena& operator=(const monotonic_arena&) = delete;
+
+    void* allocate(std::size_t size, std::size_t align) {
+        for (;;) {
+            if (current_ < blocks_.size()) {
+                block& b = blocks_[current_];
+                std::size_t offset = (b.used + align - 1) & ~(align - 1);
+                if (offset + size <= b.size) {
+                    b.used = offset + size;
+                    ++allocations_;
+                    bytes_ += size;
+                    return b.data.get() + offset;
+                }
+                if (current_ + 1 < blocks_.size()) {
+                    ++current_;
+                    continue;
+                }
+            }
+            std::size_t n = std::max(block_size_, size + align);
+            blocks_.push_back(block{std::make_unique<char[]>(n), n, 0});
+            current_ = blocks_.size() - 1;
+        }
+    }
+
+    bool owns(const void* p) const {
+        auto c = static_cast<const char*>(p);
+        for (const auto& b : blocks_) {
+            if (c >= b.data.get() && c < b.data.get() + b.size) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void reset() {
+        for (auto& b : blocks_) {
+            b.used = 0;
+        }
+        current_ = 0;
+    }
+
+    std::uint64_t allocations() const { return allocations_; }
+    std::uint64_t bytes() const { return bytes_; }
+    std::size_t blocks() const { return blocks_.size(); }
+
+private:
+    struct block {
+        std::unique_ptr<char[]> data;
+        std::size_t size;
+        std::size_t used;
+    };
+
+    std::size_t block_size_;
+    std::vector<block> blocks_;
+    std::size_t current_ = 0;
+    std::uint64_t allocations_ = 0;
+    std::uint64_t bytes_ = 0;
+};
+
+// Per-thread allocation state behind arena_allocator.
+struct arena_context {
+    monotonic_arena* arena = nullptr;
+    std::uint64_t heap_allocations = 0;
+
+    static arena_context& current() {
+        thread_local arena_context ctx;
+        return ctx;
+    }
+};
+
+// Makes an arena current for the calling thread and resets it on exit. Every
+// frame_json created inside the scope must be destroyed before it ends.
+class arena_scope {
+public:
+    explicit arena_scope(monotonic_arena& arena)
+        : arena_(arena)
+        , previous_(arena_context::current().arena)
+    {
+        arena_context::current().arena = &arena;
+    }
+
+    ~arena_scope() {
+        arena_context::current().arena = previous_;
+        arena_.reset();
+    }
+
+    arena_scope(const arena_scope&) = delete;
+    arena_scope& operator=(const arena_scope&) = delete;
+
+private:
+    monotonic_arena& arena_;
+    monotonic_arena* previous_;
+};
+
+// Stateless allocator: carves from the thread's current arena when one is set,
+// otherwise falls back to the global heap and counts the allocation.
+// Deallocation of arena memory is a no-op; the arena frees it in one shot.
+template <typename T>
+struct arena_allocator {
+    using value_type = T;
+
+    arena_allocator() = default;
+    template <typename U>
+    arena_allocator(const arena_allocator<U>&) {}
+
+    T* allocate(std::size_t n) {
+        arena_context& ctx = arena_context::current();
+        if (ctx.arena) {
+            return static_cast<T*>(ctx.arena->allocate(n * sizeof(T), alignof(T)));
+        }
+        ++ctx.heap_allocations;
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t) {
+        arena_context& ctx = arena_context::current();
+        if (ctx.arena && ctx.arena->owns(p)) {
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const arena_allocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const arena_allocator<U>&) const { return false; }
+};
+
+using arena_string = std::basic_string<char, std::char_traits<char>, arena_allocator<char>>;
+
+// JSON DOM whose objects, arrays and strings all go through arena_allocator.
+using frame_json = nlohmann::basic_json<std::map, std::vector, arena_string, bool, std::int64_t,
+                                        std::uint64_t, double, arena_allocator>;
+
+// Copies an arena document into a heap json that may outlive the arena scope.
+inline nlohmann::json to_heap_json(const frame_json& j) {
+    switch (j.type()) {
+        case frame_json::value_t::object: {
+            nlohmann::json out = nlohmann::json::object();
+            for (auto it = j.begin(); it != j.end(); ++it) {
+                out.emplace(std::string(it.key().data(), it.key().size()), to_heap_json(it.value()));
+            }
+            return out;
+        }
+        case frame_json::value_t::array: {
+            nlohmann::json out = nlohmann::json::array();
+            out.get_ref<nlohmann::json::array_t&>().reserve(j.size());
+            for (const auto& v : j) {
+                out.push_back(to_heap_json(v));
+            }
+            return out;
+        }
+        case frame_json::value_t::string: {
+            const auto& s = j.get_ref<const arena_string&>();
+            return nlohmann::json(std::string(s.data(), s.size()));
+        }
+        case frame_json::value_t::boolean:
+            return j.get<bool>();
+        case frame_json::value_t::number_integer:
+            return j.get<std::int64_t>();
+        case frame_json::value_t::number_unsigned:
+            return j.get<std::uint64_t>();
+        case frame_json::value_t::number_float:
+            return j.get<double>();
+        case frame_json::value_t::null:
+        default:
+            return nullptr;
+    }
+}
@@ -0,0 +1,180 @@
+#pragma once
+#include "common.h"
+#include "json_rpc.h"
+#include "instruments.h"
+#include "order_manager.h"
+#include "utils.h"
+#include "command_parser.h"
+#include "tsc_clock.h"
+
+// Batch mode: a file (or stdin) of request commands, one per line in the same
+// syntax as the interactive prompt. Every line is parsed, validated and encoded
+// before the first message goes out, so a typo on line 900 does not leave the
+// first 899 orders live. The encoded messages are then handed to the session in
+// one go and written back to back; responses are correlated by request id.
+//
+//     # morning setup
+//     --subscribe --channel ticker --instrument_name BTC-PERPETUAL
+//     --place --direction buy --instrument_name BTC-PERPETUAL --amount 10 --price 60000
+
+struct batch_command {
+    std::size_t line;
+    jsonrpc request;
+    std::string message;   // pre-encoded request
+    bool order_request;    // place/cancel/edit, tracked by the OrderManager
+};
+
+// Builds the request for one batch line. Only commands that map to a single
+// request are allowed; session management commands are rejected.
+inline jsonrpc make_batch_request(const command_line& cmd, const InstrumentRegistry& instruments,
+                                  const OrderManager& orders) {
+    if (cmd.has(option::place)) {
+        validate_place_order(cmd, instruments);
+        return store_required_values(cmd);
+    }
+    if (cmd.has(option::cancel)) {
+        return make_cancel_request(cmd);
+    }
+    if (cmd.has(option::edit)) {
+        auto tracked = cmd.has(option::order_id) ? orders.find(cmd.str(option::order_id)) : std::nullopt;
+        validate_edit_order(cmd, instruments.ticks().lookup(tracked ? tracked->instrument : no_symbol));
+        return store_edit_values(cmd);
+    }
+    if (cmd.has(option::get_order_book)) {
+        return make_order_book_request(cmd, instruments);
+    }
+    if (cmd.has(option::subscribe)) {
+        return make_channels_request("private/subscribe", cmd);
+    }
+    if (cmd.has(option::unsubscribe)) {
+        return make_channels_request("private/unsubscribe", cmd);
+    }
+    if (cmd.has(option::unsubscribe_all)) {
+        return jsonrpc("private/unsubscribe_all");
+    }
+    throw std::invalid_argument("Command not supported in batch mode. Use --place, --cancel, --edit, "
+                                "--get_order_book, --subscribe, --unsubscribe or --unsubscribe_all.");
+}
+
+// Parses and encodes every command. Blank lines and lines starting with '#' are
+// skipped. Throws on the first invalid line, naming its line number.
+inline std::vector<batch_command> parse_batch(std::istream& in, const InstrumentRegistry& instruments,
+                                               const OrderManager& orders) {
+    command_line cmd;
+    std::vector<batch_command> commands;
+    std::string line;
+    for (std::size_t line_no = 1; std::getline(in, line); ++line_no) {
+        std::size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        try {
+            cmd.parse(line);
+            jsonrpc request = make_batch_request(cmd, instruments, orders);
+            std::string message = request.dump();
+            bool order_request = cmd.has(option::place) || cmd.has(option::cancel) || cmd.has(option::edit);
+            commands.push_back(batch_command{line_no, std::move(request), std::move(message), order_request});
+        } catch (const std::exception& e) {
+            throw std::invalid_argument("line " + std::to_string(line_no) + ": " + e.what());
+        }
+    }
+    if (commands.empty()) {
+        throw std::invalid_argument("Batch contains no commands.");
+    }
+    return commands;
+}
+
+// Collects the responses of one batch. start() is called from the CLI thread
+// before sending, on_response() from the websocket strand.
+class BatchTracker {
+public:
+    void start(const std::vector<batch_command>& commands) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        index_.clear();
+        results_.assign(commands.size(), result{});
+        for (std::size_t i = 0; i < commands.size(); ++i) {
+            index_.emplace(commands[i].request["id"].get<std::string>(), i);
+        }
+        outstanding_ = commands.size();
+        started_ = tsc_clock::now();
+    }
+
+    // Returns true when the response belonged to the running batch.
+    bool on_response(const json& response) {
+        auto id_it = response.find("id");
+        if (id_it == response.end() || !id_it->is_string()) {
+            return false;
+        }
+        tsc_clock::ticks now = tsc_clock::now();
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = index_.find(id_it->get_ref<const std::string&>());
+        if (it == index_.end()) {
+            return false;
+        }
+        result& r = results_[it->second];
+        r.done = true;
+        r.latency = now - started_;
+        auto error_it = response.find("error");
+        if (error_it != response.end()) {
+            r.error = error_it->is_object() ? error_it->value("message", error_it->dump()) : error_it->dump();
+        }
+        index_.erase(it);
+        if (--outstanding_ == 0) {
+            cv_.notify_all();
+        }
+        return true;
+    }
+
+    // Waits until every response arrived; returns false on timeout.
+    bool wait(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        return cv_.wait_for(lock, timeout, [this] { return outstanding_ == 0; });
+    }
+
+    // Per-command latency is measured from the moment the batch was handed to the
+    // session, so later commands include the time spent queued behind earlier ones.
+    void print(std::ostream& os, const std::vector<batch_command>& commands) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<double> latencies;
+        std::size_t errors = 0;
+        for (std::size_t i = 0; i < commands.size(); ++i) {
+            const result& r = results_[i];
+            os << "  line " << commands[i].line << "  " << commands[i].request.value("method", "") << "  ";
+            if (!r.done) {
+                os << "no response\n";
+                continue;
+            }
+            double us = tsc_clock::to_ns(r.latency) / 1000;
+            latencies.push_back(us);
+            os << us << " us";
+            if (!r.error.empty()) {
+                ++errors;
+                os << "  error: " << r.error;
+            }
+            os << "\n";
+        }
+        os << commands.size() << " commands, " << latencies.size() << " responses, " << errors << " errors";
+        if (!latencies.empty()) {
+            std::sort(latencies.begin(), latencies.end());
+            os << ", latency min " << latencies.front() << " us, median " << latencies[latencies.size() / 2]
+               << " us, max " << latencies.back() << " us, "
+               << latencies.size() / (latencies.back() / 1e6) << " responses/s";
+        }
+        os << "\n";
+        index_.clear();
+    }
+
+private:
+    struct result {
+        bool done = false;
+        tsc_clock::ticks latency = 0;
+        std::string error;
+    };
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::unordered_map<std::string, std::size_t> index_;
+    std::vector<result> results_;
+    std::size_t outstanding_ = 0;
+    tsc_clock::ticks started_ = 0;
+};
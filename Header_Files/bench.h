@@ -0,0 +1,469 @@
+#pragma once
+#include "common.h"
+#include "json_rpc.h"
+#include "arena.h"
+#include "replay.h"
+#include "utils.h"
+#include "command_parser.h"
+#include "order_book.h"
+#include "json_index.h"
+#include "dispatcher.h"
+
+// Offline micro-benchmarks, run from the CLI with --bench <name> --path <input>.
+// The input is a capture prefix, or a command file for parse.
+
+// Loads every frame of a capture into memory so timings exclude disk reads.
+inline std::vector<std::string> load_capture(const std::string& prefix) {
+    capture_reader reader(prefix);
+    std::vector<std::string> frames;
+    frame_record_header header;
+    std::string_view payload;
+    while (reader.next(header, payload)) {
+        frames.emplace_back(payload);
+    }
+    if (frames.empty()) {
+        throw std::invalid_argument("No frames found in capture '" + prefix + "'.");
+    }
+    return frames;
+}
+
+struct bench_timer {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    double ns_per(std::size_t n) const {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return static_cast<double>(ns) / static_cast<double>(n);
+    }
+};
+
+// Compares per-frame DOM decoding: nlohmann json on the global heap, the same DOM
+// with counted heap allocations, and the DOM in a per-frame arena.
+inline void bench_decode(const std::string& prefix, std::ostream& os) {
+    std::vector<std::string> frames = load_capture(prefix);
+    std::size_t bytes = 0;
+    for (const auto& f : frames) {
+        bytes += f.size();
+    }
+    os << frames.size() << " frames, " << bytes / frames.size() << " bytes/frame\n";
+
+    std::size_t sink = 0;
+    {
+        bench_timer t;
+        for (const auto& f : frames) {
+            json j = json::parse(f);
+            sink += j.size();
+        }
+        os << "  json (heap):         " << t.ns_per(frames.size()) << " ns/frame\n";
+    }
+    {
+        arena_context& ctx = arena_context::current();
+        std::uint64_t before = ctx.heap_allocations;
+        bench_timer t;
+        for (const auto& f : frames) {
+            frame_json j = frame_json::parse(f);
+            sink += j.size();
+        }
+        double ns = t.ns_per(frames.size());
+        os << "  frame_json (heap):   " << ns << " ns/frame, "
+           << static_cast<double>(ctx.heap_allocations - before) / frames.size() << " heap allocs/frame\n";
+    }
+    {
+        monotonic_arena arena;
+        arena_context& ctx = arena_context::current();
+        std::uint64_t heap_before = ctx.heap_allocations;
+        std::uint64_t arena_before = arena.allocations();
+        bench_timer t;
+        for (const auto& f : frames) {
+            arena_scope scope(arena);
+            frame_json j = frame_json::parse(f);
+            sink += j.size();
+        }
+        double ns = t.ns_per(frames.size());
+        os << "  frame_json (arena):  " << ns << " ns/frame, "
+           << static_cast<double>(ctx.heap_allocations - heap_before) / frames.size() << " heap allocs/frame, "
+           << static_cast<double>(arena.allocations() - arena_before) / frames.size() << " arena allocs/frame, "
+           << arena.blocks() << " arena block(s)\n";
+    }
+    {
+        monotonic_arena arena;
+        bench_timer t;
+        for (const auto& f : frames) {
+            arena_scope scope(arena);
+            frame_json j = frame_json::parse(f);
+            json heap = to_heap_json(j);
+            sink += heap.size();
+        }
+        os << "  arena + to_heap_json: " << t.ns_per(frames.size()) << " ns/frame\n";
+    }
+    if (sink == 0) {
+        os << "  (no data)\n";
+    }
+}
+
+// Compares parsing prompt lines (e.g. a batch file) with boost::program_options, as
+// the prompt loop did per line, against the precompiled command_line grammar.
+inline void bench_parse(const std::string& path, std::ostream& os) {
+    std::ifstream in(path);
+    if (!in) {
+        throw std::invalid_argument("Cannot open '" + path + "'.");
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::size_t first = line.find_first_not_of(" \t\r");
+        if (first != std::string::npos && line[first] != '#') {
+            lines.push_back(line);
+        }
+    }
+    if (lines.empty()) {
+        throw std::invalid_argument("No command lines found in '" + path + "'.");
+    }
+    const std::size_t rounds = std::max<std::size_t>(1, 20000 / lines.size());
+    const std::size_t n = rounds * lines.size();
+    os << lines.size() << " command lines, " << rounds << " rounds\n";
+
+    std::size_t sink = 0;
+    {
+        bench_timer t;
+        for (std::size_t r = 0; r < rounds; ++r) {
+            for (const auto& l : lines) {
+                po::options_description options("Available inputs");
+                configure_cmdline_options(options);
+                po::variables_map vm;
+                po::store(po::command_line_parser(po::split_unix(l)).options(options).run(), vm);
+                po::notify(vm);
+                sink += vm.size();
+            }
+        }
+        os << "  program_options (rebuilt per line): " << t.ns_per(n) << " ns/line\n";
+    }
+    {
+        po::options_description options("Available inputs");
+        configure_cmdline_options(options);
+        bench_timer t;
+        for (std::size_t r = 0; r < rounds; ++r) {
+            for (const auto& l : lines) {
+                po::variables_map vm;
+                po::store(po::command_line_parser(po::split_unix(l)).options(options).run(), vm);
+                po::notify(vm);
+                sink += vm.size();
+            }
+        }
+        os << "  program_options (prebuilt):         " << t.ns_per(n) << " ns/line\n";
+    }
+    {
+        command_line cmd;
+        bench_timer t;
+        for (std::size_t r = 0; r < rounds; ++r) {
+            for (const auto& l : lines) {
+                cmd.parse(l);
+                sink += cmd.token_count();
+            }
+        }
+        os << "  command_line:                       " << t.ns_per(n) << " ns/line\n";
+    }
+    if (sink == 0) {
+        os << "  (no data)\n";
+    }
+}
+
+// Compares map_book against ladder_book on the book.* notifications of a capture.
+// Frames are decoded once up front; the timed loops apply each update and read the
+// top of book, as a strategy would. A final pass checks both books agree.
+inline void bench_book(const std::string& prefix, const TickTable& ticks, std::ostream& os) {
+    std::vector<std::string> frames = load_capture(prefix);
+    std::vector<book_update> updates;
+    std::size_t levels = 0;
+    instrument_id max_id = 0;
+    for (const auto& f : frames) {
+        json j = json::parse(f, nullptr, false);
+        if (j.is_discarded() || j.value("method", "") != "subscription" || !j["params"].is_object()) {
+            continue;
+        }
+        if (j["params"].value("channel", "").compare(0, 5, "book.") != 0) {
+            continue;
+        }
+        book_update u;
+        if (decode_book_update(j, ticks, u)) {
+            levels += u.levels.size();
+            max_id = std::max(max_id, u.instrument);
+            updates.push_back(std::move(u));
+        }
+    }
+    if (updates.empty()) {
+        throw std::invalid_argument("No book.* notifications found in capture '" + prefix + "'.");
+    }
+    os << updates.size() << " book updates, " << static_cast<double>(levels) / updates.size() << " levels/update\n";
+
+    // books are indexed by instrument id
+    auto run = [&](auto& books, const char* label) {
+        std::int64_t sink = 0;
+        bench_timer t;
+        for (const auto& u : updates) {
+            auto& book = books[u.instrument];
+            book.apply(u);
+            auto bid = book.best_bid();
+            auto ask = book.best_ask();
+            sink += (bid ? bid->price.units() : 0) + (ask ? ask->price.units() : 0);
+        }
+        os << "  " << label << t.ns_per(updates.size()) << " ns/update, "
+           << t.ns_per(levels) << " ns/level\n";
+        return sink;
+    };
+    std::vector<map_book> maps(max_id + 1);
+    std::vector<ladder_book> ladders(max_id + 1);
+    std::int64_t map_sink = run(maps, "map_book:    ");
+    std::int64_t ladder_sink = run(ladders, "ladder_book: ");
+
+    std::uint64_t recentres = 0;
+    std::size_t mismatches = 0;
+    for (std::size_t i = 0; i < maps.size(); ++i) {
+        recentres += ladders[i].recentres();
+        for (book_side side : {book_side::bid, book_side::ask}) {
+            std::vector<std::pair<std::int64_t, std::int64_t>> a, b;
+            maps[i].for_each(side, ~std::size_t(0), [&](book_level l) { a.emplace_back(l.price.units(), l.qty.units()); });
+            ladders[i].for_each(side, ~std::size_t(0), [&](book_level l) { b.emplace_back(l.price.units(), l.qty.units()); });
+            mismatches += a != b;
+        }
+    }
+    os << "  ladder recentres: " << recentres << ", books: " << maps.size()
+       << (mismatches == 0 && map_sink == ladder_sink ? ", books agree\n" : ", BOOKS DIFFER\n");
+}
+
+// Every number token of the frames (outside strings), as views into frames.
+inline std::vector<std::string_view> number_tokens(const std::vector<std::string>& frames) {
+    std::vector<std::string_view> tokens;
+    for (const auto& f : frames) {
+        for (std::size_t i = 0; i < f.size();) {
+            char c = f[i];
+            if (c == '"') {
+                for (++i; i < f.size() && f[i] != '"'; ++i) {
+                    i += f[i] == '\\';
+                }
+                ++i;
+            } else if (c == '-' || (c >= '0' && c <= '9')) {
+                std::size_t start = i;
+                while (i < f.size() && (std::isdigit(static_cast<unsigned char>(f[i])) ||
+                                        f[i] == '.' || f[i] == '-' || f[i] == '+' || f[i] == 'e' || f[i] == 'E')) {
+                    ++i;
+                }
+                tokens.emplace_back(f.data() + start, i - start);
+            } else {
+                ++i;
+            }
+        }
+    }
+    return tokens;
+}
+
+// Compares number conversion on the numeric fields of a capture: strtod and
+// std::from_chars against parse_double, and parse_decimal_scalar against the
+// SIMD parse_decimal into 10^-8 units. Results must match bit for bit.
+inline void bench_numbers(const std::string& prefix, std::ostream& os) {
+    std::vector<std::string> frames = load_capture(prefix);
+    std::vector<std::string_view> tokens = number_tokens(frames);
+    if (tokens.empty()) {
+        throw std::invalid_argument("No numbers found in capture '" + prefix + "'.");
+    }
+    std::size_t chars = 0;
+    for (auto t : tokens) {
+        chars += t.size();
+    }
+    os << tokens.size() << " numbers, " << static_cast<double>(chars) / tokens.size() << " chars/number\n";
+
+    std::vector<double> reference(tokens.size()), fast(tokens.size());
+    std::vector<std::int64_t> scalar_fixed(tokens.size()), simd_fixed(tokens.size());
+    std::size_t failed = 0;
+    double sink = 0;
+    {
+        bench_timer t;
+        for (auto tok : tokens) {
+            // tokens are followed by a delimiter, so strtod stops at their end
+            sink += std::strtod(tok.data(), nullptr);
+        }
+        os << "  strtod:               " << t.ns_per(tokens.size()) << " ns/number\n";
+    }
+    {
+        bench_timer t;
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            std::from_chars(tokens[i].data(), tokens[i].data() + tokens[i].size(), reference[i]);
+        }
+        os << "  std::from_chars:      " << t.ns_per(tokens.size()) << " ns/number\n";
+    }
+    {
+        bench_timer t;
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            failed += !parse_double(tokens[i], fast[i]);
+        }
+        os << "  parse_double:         " << t.ns_per(tokens.size()) << " ns/number\n";
+    }
+    std::size_t scalar_ok = 0, simd_ok = 0;
+    {
+        bench_timer t;
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            scalar_ok += parse_decimal_scalar(tokens[i], 8, scalar_fixed[i]);
+        }
+        os << "  parse_decimal_scalar: " << t.ns_per(tokens.size()) << " ns/number\n";
+    }
+    {
+        bench_timer t;
+        for (std::size_t i = 0; i < tokens.size(); ++i) {
+            simd_ok += parse_decimal(tokens[i], 8, simd_fixed[i]);
+        }
+        os << "  parse_decimal:        " << t.ns_per(tokens.size()) << " ns/number\n";
+    }
+
+    std::size_t mismatches = failed + (scalar_ok != simd_ok);
+    for (std::size_t i = 0; i < tokens.size(); ++i) {
+        mismatches += std::memcmp(&reference[i], &fast[i], sizeof(double)) != 0;
+        mismatches += scalar_fixed[i] != simd_fixed[i];
+    }
+    os << "  " << simd_ok << " numbers fit 10^-8 units, "
+       << (mismatches == 0 ? "results identical\n" : std::to_string(mismatches) + " MISMATCHES\n");
+    if (sink == 0) {
+        os << "  (no data)\n";
+    }
+}
+
+// Throughput of decoding a capture: nlohmann's parser, the structural index
+// alone, the index plus the lazy reads the dispatcher routes on, and the index
+// plus a full DOM built from it, which must equal nlohmann's.
+inline void bench_json(const std::string& prefix, std::ostream& os) {
+    std::vector<std::string> frames = load_capture(prefix);
+    std::size_t bytes = 0;
+    for (const auto& f : frames) {
+        bytes += f.size();
+    }
+    os << frames.size() << " frames, " << bytes / frames.size() << " bytes/frame\n";
+    auto report = [&](const char* label, const bench_timer& t) {
+        const double ns = t.ns_per(1);
+        os << "  " << label << static_cast<double>(bytes) / ns << " GB/s, " << ns / frames.size() << " ns/frame\n";
+    };
+
+    std::size_t sink = 0;
+    {
+        bench_timer t;
+        for (const auto& f : frames) {
+            json j = json::parse(f);
+            sink += j.size();
+        }
+        report("json::parse:          ", t);
+    }
+    json_document doc;
+    {
+        bench_timer t;
+        for (const auto& f : frames) {
+            doc.parse(f);
+            sink += doc.index().size();
+        }
+        report("index only:           ", t);
+    }
+    {
+        bench_timer t;
+        for (const auto& f : frames) {
+            doc.parse(f);
+            json_element root = doc.root();
+            if (auto method = root.find("method"); method && method->is_string()) {
+                sink += method->raw_string().size();
+            }
+            if (auto params = root.find("params")) {
+                if (auto channel = params->find("channel"); channel && channel->is_string()) {
+                    sink += channel->raw_string().size();
+                }
+            }
+            if (auto us_out = root.find("usOut")) {
+                sink += static_cast<std::size_t>(us_out->get_int64());
+            }
+        }
+        report("index + routing reads:", t);
+    }
+    {
+        bench_timer t;
+        for (const auto& f : frames) {
+            doc.parse(f);
+            json j = doc.to_json();
+            sink += j.size();
+        }
+        report("index + to_json:      ", t);
+    }
+
+    std::size_t mismatches = 0;
+    for (const auto& f : frames) {
+        doc.parse(f);
+        mismatches += doc.to_json() != json::parse(f);
+    }
+    os << "  " << (mismatches == 0 ? "DOMs identical" : std::to_string(mismatches) + " DOM MISMATCHES") << "\n";
+    if (sink == 0) {
+        os << "  (no data)\n";
+    }
+}
+
+// Read-strand cost per frame: a full json::parse against classify_frame alone and
+// classify_frame plus the raw copy decode_mode::lazy queues. Every frame must be
+// classified as the parser sees it.
+inline void bench_classify(const std::string& prefix, std::ostream& os) {
+    std::vector<std::string> frames = load_capture(prefix);
+    std::size_t notifications = 0;
+    std::size_t mismatches = 0;
+    for (const auto& f : frames) {
+        json j = json::parse(f, nullptr, false);
+        frame_class c = classify_frame(f);
+        bool expected = !j.is_discarded() && j.value("method", "") == "subscription" &&
+                        j.contains("params") && j["params"].is_object() && j["params"].contains("channel") &&
+                        !j.contains("id") && !j.contains("result") && !j.contains("error");
+        notifications += expected;
+        mismatches += expected != (c.kind == frame_kind::notification) ||
+                      (expected && j["params"]["channel"] != c.channel);
+    }
+    os << frames.size() << " frames, " << notifications << " notifications\n";
+
+    std::size_t sink = 0;
+    {
+        bench_timer t;
+        for (const auto& f : frames) {
+            json j = json::parse(f);
+            sink += j.size();
+        }
+        os << "  json::parse:             " << t.ns_per(frames.size()) << " ns/frame\n";
+    }
+    {
+        bench_timer t;
+        for (const auto& f : frames) {
+            sink += classify_frame(f).channel.size();
+        }
+        os << "  classify_frame:          " << t.ns_per(frames.size()) << " ns/frame\n";
+    }
+    {
+        bench_timer t;
+        for (const auto& f : frames) {
+            frame_class c = classify_frame(f);
+            if (c.kind == frame_kind::notification) {
+                lazy_json msg(f, 0, nullptr);
+                sink += msg.raw().size();
+            }
+        }
+        os << "  classify + raw copy:     " << t.ns_per(frames.size()) << " ns/frame\n";
+    }
+    os << "  " << (mismatches == 0 ? "classification matches json::parse" : std::to_string(mismatches) + " MISCLASSIFIED") << "\n";
+    if (sink == 0) {
+        os << "  (no data)\n";
+    }
+}
+
+inline void run_bench(const std::string& name, const std::string& prefix, const TickTable& ticks, std::ostream& os) {
+    if (name == "decode") {
+        bench_decode(prefix, os);
+    } else if (name == "parse") {
+        bench_parse(prefix, os);
+    } else if (name == "book") {
+        bench_book(prefix, ticks, os);
+    } else if (name == "numbers") {
+        bench_numbers(prefix, os);
+    } else if (name == "json") {
+        bench_json(prefix, os);
+    } else if (name == "classify") {
+        bench_classify(prefix, os);
+    } else {
+        throw std::invalid_argument("Unknown benchmark '" + name + "'. Available: decode, parse, book, numbers, json, classify.");
+    }
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include "common.h"
+
+#include <atomic>
+#include <cstring>
+#include <string_view>
+
+// Subscription channels interned into dense ids. Every channel string
+// ("book.BTC-PERPETUAL.100ms", "ticker.ETH-PERPETUAL.raw", ...) gets an id the
+// first time it is subscribed; the id and the route decided for it (conflated
+// or FIFO feed) never change, while unsubscribing only clears the active flag.
+//
+// The CLI thread changes the registry; the session strand routes notifications
+// through an immutable channel_table snapshot. Each change publishes a new
+// snapshot and bumps version(), so a router reloads only after a change and
+// otherwise pays one atomic load, one hash of the channel bytes and one compare
+// per notification, however many channels there are.
+using channel_id = std::uint32_t;
+
+enum class channel_route : std::uint8_t { feed, conflated };
+
+struct channel_entry {
+    channel_id id;
+    std::string name;
+    channel_route route;
+    bool active;
+};
+
+// Open-addressing hash table from channel name to entry, at most half full.
+class channel_table {
+public:
+    // FNV-1a; channel names are short and this runs once per notification.
+    static std::uint64_t hash(std::string_view s) noexcept {
+        std::uint64_t h = 14695981039346656037ull;
+        for (unsigned char c : s) {
+            h = (h ^ c) * 1099511628211ull;
+        }
+        return h;
+    }
+
+    explicit channel_table(std::vector<channel_entry> entries)
+        : entries_(std::move(entries))
+    {
+        std::size_t capacity = 16;
+        while (capacity < entries_.size() * 2) {
+            capacity *= 2;
+        }
+        slots_.assign(capacity, slot{});
+        mask_ = capacity - 1;
+        for (std::size_t i = 0; i < entries_.size(); ++i) {
+            std::uint64_t h = hash(entries_[i].name);
+            std::size_t index = h & mask_;
+            while (slots_[index].entry != 0) {
+                index = (index + 1) & mask_;
+            }
+            slots_[index] = {static_cast<std::uint32_t>(i + 1), static_cast<std::uint32_t>(h >> 32)};
+        }
+    }
+
+    const channel_entry* find(std::string_view name) const noexcept {
+        std::uint64_t h = hash(name);
+        const auto tag = static_cast<std::uint32_t>(h >> 32);
+        for (std::size_t index = h & mask_; slots_[index].entry != 0; index = (index + 1) & mask_) {
+            // the stored hash bits skip the entry on collisions
+            if (slots_[index].tag != tag) {
+                continue;
+            }
+            const channel_entry& e = entries_[slots_[index].entry - 1];
+            if (e.name.size() == name.size() && std::memcmp(e.name.data(), name.data(), name.size()) == 0) {
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+    // Indexed by id.
+    const std::vector<channel_entry>& entries() const noexcept { return entries_; }
+
+private:
+    struct slot {
+        std::uint32_t entry = 0;   // index + 1, 0 = empty
+        std::uint32_t tag = 0;     // high hash bits
+    };
+
+    std::vector<channel_entry> entries_;
+    std::vector<slot> slots_;
+    std::size_t mask_ = 0;
+};
+
+class channel_registry {
+public:
+    channel_registry()
+        : table_(std::make_shared<const channel_table>(std::vector<channel_entry>{}))
+    {
+    }
+
+    // Channels starting with one of prefixes are routed to the last-value queue.
+    // Applies to channels interned afterwards.
+    void set_conflation(std::vector<std::string> prefixes) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        conflated_prefixes_ = std::move(prefixes);
+    }
+
+    // Interns channels and marks them active; returns their ids in order.
+    std::vector<channel_id> subscribe(const std::vector<std::string>& channels) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<channel_entry> entries = table_->entries();
+        std::vector<channel_id> ids;
+        ids.reserve(channels.size());
+        // names interned earlier in this call are not in table_ yet
+        std::unordered_map<std::string_view, channel_id> added;
+        for (const auto& name : channels) {
+            channel_id id = intern_locked(entries, added, name);
+            entries[id].active = true;
+            ids.push_back(id);
+        }
+        publish_locked(std::move(entries));
+        return ids;
+    }
+
+    void unsubscribe(const std::vector<std::string>& channels) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<channel_entry> entries = table_->entries();
+        for (const auto& name : channels) {
+            if (const channel_entry* e = table_->find(name)) {
+                entries[e->id].active = false;
+            }
+        }
+        publish_locked(std::move(entries));
+    }
+
+    // private/unsubscribe_all, or a new connection, which starts without subscriptions.
+    void unsubscribe_all() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<channel_entry> entries = table_->entries();
+        for (auto& e : entries) {
+            e.active = false;
+        }
+        publish_locked(std::move(entries));
+    }
+
+    std::shared_ptr<const channel_table> table() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return table_;
+    }
+
+    std::uint64_t version() const noexcept {
+        return version_.load(std::memory_order_acquire);
+    }
+
+    std::size_t size() const {
+        return table()->entries().size();
+    }
+
+    std::size_t active_count() const {
+        auto t = table();
+        return static_cast<std::size_t>(std::count_if(t->entries().begin(), t->entries().end(),
+            [](const channel_entry& e) { return e.active; }));
+    }
+
+private:
+    channel_id intern_locked(std::vector<channel_entry>& entries,
+                             std::unordered_map<std::string_view, channel_id>& added, const std::string& name) {
+        if (const channel_entry* e = table_->find(name)) {
+            return e->id;
+        }
+        if (auto it = added.find(name); it != added.end()) {
+            return it->second;
+        }
+        channel_route route = channel_route::feed;
+        for (const auto& prefix : conflated_prefixes_) {
+            if (name.compare(0, prefix.size(), prefix) == 0) {
+                route = channel_route::conflated;
+                break;
+            }
+        }
+        auto id = static_cast<channel_id>(entries.size());
+        entries.push_back({id, name, route, false});
+        added.emplace(name, id);
+        return id;
+    }
+
+    void publish_locked(std::vector<channel_entry> entries) {
+        table_ = std::make_shared<const channel_table>(std::move(entries));
+        version_.fetch_add(1, std::memory_order_release);
+    }
+
+    mutable std::mutex mtx_;
+    std::shared_ptr<const channel_table> table_;
+    std::atomic<std::uint64_t> version_{0};
+    std::vector<std::string> conflated_prefixes_;
+};
@@ -0,0 +1,130 @@
+#pragma once
+#include "common.h"
+
+#include <cmath>
+
+// Estimates the offset between the local wall clock and the exchange clock from
+// public/get_time round trips, NTP style. A sample sent at local t0 and answered at
+// t1 with exchange time T gives offset T - (t0 + t1) / 2, wrong by at most half the
+// round trip. Only samples whose RTT is close to the best one in the window are
+// trusted; over those a least-squares line gives the current offset and the drift
+// between the two clocks, so the estimate stays usable between samples.
+//
+// Samples come from the session strand; offsets are read from any thread.
+
+struct clock_estimate {
+    bool valid = false;
+    std::int64_t offset_ns = 0;     // exchange - local at ref_local_ns
+    double drift_ppm = 0;           // change of offset per local second, in microseconds
+    std::int64_t ref_local_ns = 0;
+    std::int64_t best_rtt_ns = 0;
+    std::size_t samples = 0;        // in the window
+    std::size_t trusted = 0;        // of those, used for the fit
+};
+
+class ClockSync {
+public:
+    // Local wall clock, ns since the epoch; the exchange reports epoch time too.
+    static std::int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    explicit ClockSync(std::size_t window = 64)
+        : window_(window)
+    {
+    }
+
+    // exchange_ms is the result of public/get_time, sent at sent_ns and received
+    // at received_ns (both from now_ns()).
+    void add_sample(std::int64_t sent_ns, std::int64_t exchange_ms, std::int64_t received_ns) {
+        if (received_ns < sent_ns) {
+            return;
+        }
+        sample s;
+        s.local_ns = sent_ns + (received_ns - sent_ns) / 2;
+        // the exchange truncates to milliseconds; assume the middle of the millisecond
+        s.offset_ns = exchange_ms * 1000000 + 500000 - s.local_ns;
+        s.rtt_ns = received_ns - sent_ns;
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        samples_.push_back(s);
+        if (samples_.size() > window_) {
+            samples_.pop_front();
+        }
+        estimate_ = fit();
+    }
+
+    clock_estimate estimate() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return estimate_;
+    }
+
+    bool synced() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return estimate_.valid;
+    }
+
+    std::size_t sample_count() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return samples_.size();
+    }
+
+    // Exchange time in microseconds at local time local_ns; only meaningful once synced().
+    std::int64_t to_exchange_us(std::int64_t local_ns) const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        double offset = estimate_.offset_ns + estimate_.drift_ppm * 1e-6 * (local_ns - estimate_.ref_local_ns);
+        return (local_ns + static_cast<std::int64_t>(offset)) / 1000;
+    }
+
+private:
+    struct sample {
+        std::int64_t local_ns;
+        std::int64_t offset_ns;
+        std::int64_t rtt_ns;
+    };
+
+    clock_estimate fit() const {
+        clock_estimate e;
+        e.samples = samples_.size();
+        e.best_rtt_ns = std::min_element(samples_.begin(), samples_.end(), [](const sample& a, const sample& b) {
+            return a.rtt_ns < b.rtt_ns;
+        })->rtt_ns;
+
+        // queueing only ever adds delay, so low-RTT samples carry the least error
+        const std::int64_t limit = e.best_rtt_ns + e.best_rtt_ns / 2 + 200000;
+        double mean_t = 0, mean_o = 0;
+        for (const auto& s : samples_) {
+            if (s.rtt_ns <= limit) {
+                mean_t += s.local_ns - samples_.front().local_ns;
+                mean_o += s.offset_ns;
+                ++e.trusted;
+            }
+        }
+        mean_t /= e.trusted;
+        mean_o /= e.trusted;
+
+        double stt = 0, sto = 0;
+        for (const auto& s : samples_) {
+            if (s.rtt_ns <= limit) {
+                double dt = (s.local_ns - samples_.front().local_ns) - mean_t;
+                stt += dt * dt;
+                sto += dt * (s.offset_ns - mean_o);
+            }
+        }
+        e.ref_local_ns = samples_.front().local_ns + static_cast<std::int64_t>(mean_t);
+        e.offset_ns = static_cast<std::int64_t>(mean_o);
+        // a slope over less than a few seconds is mostly millisecond quantisation
+        const double span_s = std::sqrt(stt / e.trusted) * 1e-9;
+        if (e.trusted >= 4 && span_s >= 5.0) {
+            e.drift_ppm = sto / stt * 1e6;
+        }
+        e.valid = true;
+        return e;
+    }
+
+    mutable std::mutex mtx_;
+    std::size_t window_;
+    std::deque<sample> samples_;
+    clock_estimate estimate_;
+};
@@ -0,0 +1,403 @@
+#pragma once
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Command grammar of the prompt and of batch files, replacing a per-line
+// boost::program_options rebuild. The option table is a compile-time constant,
+// keywords are found through a perfect hash whose seed is searched at compile
+// time, and values are decoded in place into command_line. Parsing a valid line
+// does not allocate: text values are views into the caller's line, which must
+// outlive the command_line.
+//
+//     command_line cmd;
+//     cmd.parse("--place --direction buy --instrument_name BTC-PERPETUAL --amount 10 --price 60000");
+//     cmd.command() == option::place; cmd.number(option::price) == 60000
+
+enum class value_kind : std::uint8_t {
+    none,       // flag
+    text,
+    list,       // multi-token, repeatable
+    integer,
+    unsigned_integer,
+    number,
+    boolean,
+};
+
+enum class option : std::uint8_t {
+    // commands
+    help, connect, auth, exit, place, cancel, edit, orders, feed, rtt, queue_stats,
+    session_stats, heartbeat, clock, queue_config, record, record_stop, replay, decode,
+    timestamping, trace, metrics, bench, batch, instruments, get_order_book, subscribe,
+    unsubscribe, unsubscribe_all,
+    // parameters
+    count, watch, queue, capacity, policy, path, speed, order_id, channel,
+    instrument_name, depth, direction, type, amount, contracts, price, trigger_price,
+    trigger, post_only, reject_post_only, mmp, label, max_show, valid_until, trigger_offset,
+    ping_interval, liveness_timeout, port,
+};
+
+struct option_spec {
+    std::string_view name;
+    value_kind kind;
+    bool command;
+};
+
+// Indexed by option; keep in the enum's order.
+inline constexpr option_spec option_specs[] = {
+    {"help", value_kind::none, true},
+    {"connect", value_kind::none, true},
+    {"auth", value_kind::none, true},
+    {"exit", value_kind::none, true},
+    {"place", value_kind::none, true},
+    {"cancel", value_kind::none, true},
+    {"edit", value_kind::none, true},
+    {"orders", value_kind::none, true},
+    {"feed", value_kind::none, true},
+    {"rtt", value_kind::none, true},
+    {"queue_stats", value_kind::none, true},
+    {"session_stats", value_kind::none, true},
+    {"heartbeat", value_kind::none, true},
+    {"clock", value_kind::none, true},
+    {"queue_config", value_kind::none, true},
+    {"record", value_kind::none, true},
+    {"record_stop", value_kind::none, true},
+    {"replay", value_kind::none, true},
+    {"decode", value_kind::text, true},
+    {"timestamping", value_kind::text, true},
+    {"trace", value_kind::text, true},
+    {"metrics", value_kind::text, true},
+    {"bench", value_kind::text, true},
+    {"batch", value_kind::text, true},
+    {"instruments", value_kind::none, true},
+    {"get_order_book", value_kind::none, true},
+    {"subscribe", value_kind::none, true},
+    {"unsubscribe", value_kind::none, true},
+    {"unsubscribe_all", value_kind::none, true},
+    {"count", value_kind::integer, false},
+    {"watch", value_kind::integer, false},
+    {"queue", value_kind::text, false},
+    {"capacity", value_kind::unsigned_integer, false},
+    {"policy", value_kind::text, false},
+    {"path", value_kind::text, false},
+    {"speed", value_kind::number, false},
+    {"order_id", value_kind::text, false},
+    {"channel", value_kind::list, false},
+    {"instrument_name", value_kind::list, false},
+    {"depth", value_kind::integer, false},
+    {"direction", value_kind::text, false},
+    {"type", value_kind::text, false},
+    {"amount", value_kind::number, false},
+    {"contracts", value_kind::number, false},
+    {"price", value_kind::number, false},
+    {"trigger_price", value_kind::number, false},
+    {"trigger", value_kind::text, false},
+    {"post_only", value_kind::boolean, false},
+    {"reject_post_only", value_kind::boolean, false},
+    {"mmp", value_kind::boolean, false},
+    {"label", value_kind::text, false},
+    {"max_show", value_kind::number, false},
+    {"valid_until", value_kind::integer, false},
+    {"trigger_offset", value_kind::number, false},
+    {"ping_interval", value_kind::integer, false},
+    {"liveness_timeout", value_kind::integer, false},
+    {"port", value_kind::integer, false},
+};
+
+inline constexpr std::size_t option_count = std::size(option_specs);
+static_assert(option_count == static_cast<std::size_t>(option::port) + 1, "option_specs out of sync with option");
+static_assert(option_count <= 64, "presence is tracked in a 64-bit mask");
+
+constexpr std::string_view option_name(option o) {
+    return option_specs[static_cast<std::size_t>(o)].name;
+}
+
+// Perfect hash over the option names: seeded FNV-1a with a final mix, the seed
+// chosen at compile time so that every name lands in its own slot of a 256-entry table.
+namespace keyword_hash {
+
+inline constexpr std::size_t table_size = 256;
+inline constexpr std::uint8_t empty_slot = 0xff;
+
+constexpr std::uint32_t hash(std::string_view s, std::uint32_t seed) {
+    std::uint32_t h = seed;
+    for (char c : s) {
+        h = (h ^ static_cast<unsigned char>(c)) * 16777619u;
+    }
+    // FNV's low bits mix poorly; fold the high bits in before masking
+    h ^= h >> 16;
+    h *= 0x45d9f3bu;
+    return h ^ (h >> 16);
+}
+
+constexpr std::uint32_t find_seed() {
+    for (std::uint32_t seed = 2166136261u;; ++seed) {
+        bool used[table_size] = {};
+        bool collision = false;
+        for (const auto& spec : option_specs) {
+            std::size_t slot = hash(spec.name, seed) & (table_size - 1);
+            if (used[slot]) {
+                collision = true;
+                break;
+            }
+            used[slot] = true;
+        }
+        if (!collision) {
+            return seed;
+        }
+    }
+}
+
+inline constexpr std::uint32_t seed = find_seed();
+
+constexpr std::array<std::uint8_t, table_size> build_table() {
+    std::array<std::uint8_t, table_size> table{};
+    for (auto& slot : table) {
+        slot = empty_slot;
+    }
+    for (std::size_t i = 0; i < option_count; ++i) {
+        table[hash(option_specs[i].name, seed) & (table_size - 1)] = static_cast<std::uint8_t>(i);
+    }
+    return table;
+}
+
+inline constexpr std::array<std::uint8_t, table_size> table = build_table();
+
+} // namespace keyword_hash
+
+constexpr std::optional<option> find_option(std::string_view name) {
+    std::uint8_t index = keyword_hash::table[keyword_hash::hash(name, keyword_hash::seed) & (keyword_hash::table_size - 1)];
+    if (index == keyword_hash::empty_slot || option_specs[index].name != name) {
+        return std::nullopt;
+    }
+    return static_cast<option>(index);
+}
+
+static_assert(find_option("trigger_price") == option::trigger_price);
+static_assert(!find_option("trigger_pric"));
+
+class command_line {
+public:
+    static constexpr std::size_t max_tokens = 64;
+    static constexpr std::size_t max_list_values = 16;
+
+    // Parses one line. Throws std::invalid_argument on unknown options, missing or
+    // malformed values, repeated scalar options or more than one command.
+    void parse(std::string_view line) {
+        present_ = 0;
+        command_.reset();
+        list_sizes_ = {};
+        tokenize(line);
+
+        for (std::size_t i = 0; i < token_count_; ++i) {
+            std::string_view token = tokens_[i];
+            std::string_view name;
+            std::optional<std::string_view> inline_value;
+            if (token == "-h") {
+                name = "help";
+            } else if (token.size() > 2 && token.substr(0, 2) == "--") {
+                name = token.substr(2);
+                std::size_t eq = name.find('=');
+                if (eq != std::string_view::npos) {
+                    inline_value = name.substr(eq + 1);
+                    name = name.substr(0, eq);
+                }
+            } else {
+                fail("unexpected argument '", token, "'");
+            }
+
+            std::optional<option> o = find_option(name);
+            if (!o) {
+                fail("unrecognised option '--", name, "'");
+            }
+            const option_spec& spec = option_specs[static_cast<std::size_t>(*o)];
+            if (spec.command) {
+                if (command_) {
+                    fail("only one command is allowed per line, got '--", name, "' after '--" + std::string(option_name(*command_)) + "'");
+                }
+                command_ = *o;
+            }
+            if (spec.kind != value_kind::list && has(*o)) {
+                fail("option '--", name, "' cannot be specified more than once");
+            }
+            present_ |= bit(*o);
+
+            if (spec.kind == value_kind::none) {
+                if (inline_value) {
+                    fail("option '--", name, "' does not take a value");
+                }
+                continue;
+            }
+            if (spec.kind == value_kind::list) {
+                if (inline_value) {
+                    push_list(*o, *inline_value);
+                }
+                // multi-token: consume until the next option
+                while (i + 1 < token_count_ && !is_option(tokens_[i + 1])) {
+                    push_list(*o, tokens_[++i]);
+                }
+                if (list_size(*o) == 0) {
+                    fail("option '--", name, "' requires at least one value");
+                }
+                continue;
+            }
+            std::string_view value;
+            if (inline_value) {
+                value = *inline_value;
+            } else if (i + 1 < token_count_ && !is_option(tokens_[i + 1])) {
+                value = tokens_[++i];
+            } else {
+                fail("option '--", name, "' requires a value");
+            }
+            store(*o, spec.kind, value);
+        }
+    }
+
+    bool empty() const { return token_count_ == 0; }
+    std::size_t token_count() const { return token_count_; }
+    std::optional<option> command() const { return command_; }
+
+    bool has(option o) const { return (present_ & bit(o)) != 0; }
+
+    std::string_view text(option o, std::string_view fallback = {}) const {
+        return has(o) ? values_[index(o)].text : fallback;
+    }
+    std::string str(option o, std::string_view fallback = {}) const {
+        return std::string(text(o, fallback));
+    }
+    double number(option o, double fallback = 0) const {
+        return has(o) ? values_[index(o)].number : fallback;
+    }
+    std::int64_t integer(option o, std::int64_t fallback = 0) const {
+        return has(o) ? values_[index(o)].integer : fallback;
+    }
+    bool boolean(option o) const {
+        return has(o) && values_[index(o)].boolean;
+    }
+    std::span<const std::string_view> list(option o) const {
+        std::size_t slot = list_slot(o);
+        return std::span<const std::string_view>(lists_[slot].data(), list_sizes_[slot]);
+    }
+
+private:
+    struct value {
+        std::string_view text;
+        double number = 0;
+        std::int64_t integer = 0;
+        bool boolean = false;
+    };
+
+    static constexpr std::size_t index(option o) { return static_cast<std::size_t>(o); }
+    static constexpr std::uint64_t bit(option o) { return std::uint64_t(1) << index(o); }
+
+    static constexpr std::size_t list_slot(option o) {
+        return o == option::channel ? 0 : 1;
+    }
+
+    static bool is_option(std::string_view token) {
+        return token == "-h" || (token.size() > 2 && token.substr(0, 2) == "--");
+    }
+
+    [[noreturn]] static void fail(const char* what, std::string_view name, std::string_view rest) {
+        throw std::invalid_argument(std::string(what) + std::string(name) + std::string(rest));
+    }
+
+    // Whitespace separated tokens; a token may be wrapped in single or double quotes.
+    void tokenize(std::string_view line) {
+        token_count_ = 0;
+        std::size_t i = 0;
+        while (i < line.size()) {
+            char c = line[i];
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+                ++i;
+                continue;
+            }
+            if (token_count_ == max_tokens) {
+                throw std::invalid_argument("too many arguments");
+            }
+            std::size_t start = i;
+            if (c == '"' || c == '\'') {
+                std::size_t close = line.find(c, i + 1);
+                if (close == std::string_view::npos) {
+                    throw std::invalid_argument("unterminated quote");
+                }
+                tokens_[token_count_++] = line.substr(start + 1, close - start - 1);
+                i = close + 1;
+                continue;
+            }
+            while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r' && line[i] != '\n') {
+                ++i;
+            }
+            tokens_[token_count_++] = line.substr(start, i - start);
+        }
+    }
+
+    void push_list(option o, std::string_view v) {
+        std::size_t slot = list_slot(o);
+        if (list_sizes_[slot] == max_list_values) {
+            fail("too many values for option '--", option_name(o), "'");
+        }
+        lists_[slot][list_sizes_[slot]++] = v;
+    }
+
+    std::size_t list_size(option o) const {
+        return list_sizes_[list_slot(o)];
+    }
+
+    void store(option o, value_kind kind, std::string_view s) {
+        value& v = values_[index(o)];
+        v.text = s;
+        const char* first = s.data();
+        const char* last = s.data() + s.size();
+        switch (kind) {
+            case value_kind::integer: {
+                auto [ptr, ec] = std::from_chars(first, last, v.integer);
+                if (ec != std::errc() || ptr != last) {
+                    fail("the argument ('", s, "') for option '--" + std::string(option_name(o)) + "' is invalid");
+                }
+                break;
+            }
+            case value_kind::unsigned_integer: {
+                std::uint64_t u = 0;
+                auto [ptr, ec] = std::from_chars(first, last, u);
+                if (ec != std::errc() || ptr != last || u > std::uint64_t(INT64_MAX)) {
+                    fail("the argument ('", s, "') for option '--" + std::string(option_name(o)) + "' is invalid");
+                }
+                v.integer = static_cast<std::int64_t>(u);
+                break;
+            }
+            case value_kind::number: {
+                auto [ptr, ec] = std::from_chars(first, last, v.number);
+                if (ec != std::errc() || ptr != last) {
+                    fail("the argument ('", s, "') for option '--" + std::string(option_name(o)) + "' is invalid");
+                }
+                break;
+            }
+            case value_kind::boolean: {
+                if (s == "true" || s == "1" || s == "yes" || s == "on") {
+                    v.boolean = true;
+                } else if (s == "false" || s == "0" || s == "no" || s == "off") {
+                    v.boolean = false;
+                } else {
+                    fail("the argument ('", s, "') for option '--" + std::string(option_name(o)) + "' is invalid");
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    std::array<std::string_view, max_tokens> tokens_;
+    std::size_t token_count_ = 0;
+    std::uint64_t present_ = 0;
+    std::optional<option> command_;
+    std::array<value, option_count> values_;
+    std::array<std::array<std::string_view, max_list_values>, 2> lists_;
+    std::array<std::uint8_t, 2> list_sizes_{};
+};
@@ -0,0 +1,240 @@
+#pragma once
+#include "json_rpc.h"
+#include "common.h"
+#include "websocket.h"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <charconv>
+#include <string_view>
+
+// Coroutine flavour of the websocket session.
+//
+// connect() performs resolve, TCP connect, TLS and websocket handshakes as one
+// coroutine, then starts a reader and a writer coroutine. call() sends a JSON-RPC
+// request and resumes the caller with the matching response:
+//
+//     co_await client->connect("test.deribit.com", "443", "/ws/api/v2");
+//     json r = co_await client->call("private/buy", params);
+//
+// Everything runs on the session's strand; call() must be awaited from a coroutine
+// spawned on get_executor(). Requests use integer ids that index a pool of reusable
+// call slots (timer + encode buffer), and Asio recycles awaitable frames per
+// thread, so steady-state calls do not allocate for bookkeeping.
+class coro_session : public std::enable_shared_from_this<coro_session>
+{
+public:
+    using executor_type = net::strand<net::io_context::executor_type>;
+
+    coro_session(net::io_context& ioc, ssl::context& ctx)
+        : strand_(net::make_strand(ioc))
+        , resolver_(strand_)
+        , ws_(strand_, ctx)
+        , write_signal_(strand_)
+    {
+    }
+
+    executor_type get_executor() const {
+        return strand_;
+    }
+
+    // Called on the strand for every frame that is not a response to call().
+    void set_notification_handler(std::function<void(json&)> handler) {
+        notification_handler_ = std::move(handler);
+    }
+
+    net::awaitable<void> connect(std::string host, std::string port, std::string endpoint) {
+        auto results = co_await resolver_.async_resolve(host, port, net::use_awaitable);
+
+        beast::get_lowest_layer(ws_).expires_after(std::chrono::seconds(30));
+        auto ep = co_await beast::get_lowest_layer(ws_).async_connect(results, net::use_awaitable);
+
+        if (!SSL_set_tlsext_host_name(ws_.next_layer().native_handle(), host.c_str())) {
+            throw beast::system_error(beast::error_code(static_cast<int>(::ERR_get_error()),
+                                                        net::error::get_ssl_category()));
+        }
+        beast::get_lowest_layer(ws_).expires_after(std::chrono::seconds(30));
+        co_await ws_.next_layer().async_handshake(ssl::stream_base::client, net::use_awaitable);
+
+        beast::get_lowest_layer(ws_).expires_never();
+        ws_.set_option(websocket::stream_base::timeout::suggested(beast::role_type::client));
+        ws_.set_option(websocket::stream_base::decorator([](websocket::request_type& req) {
+            req.set(http::field::user_agent, std::string(BOOST_BEAST_VERSION_STRING) + " websocket-client-coro-ssl");
+        }));
+        co_await ws_.async_handshake(host + ':' + std::to_string(ep.port()), endpoint, net::use_awaitable);
+
+        open_ = true;
+        auto self = shared_from_this();
+        net::co_spawn(strand_, [self] { return self->read_loop(); }, net::detached);
+        net::co_spawn(strand_, [self] { return self->write_loop(); }, net::detached);
+    }
+
+    // Sends method/params and returns the full response ("result" or "error").
+    // Throws boost::system::system_error if the connection fails first.
+    net::awaitable<json> call(std::string_view method, const json& params = json::object()) {
+        if (!open_) {
+            throw beast::system_error(net::error::not_connected);
+        }
+        std::uint32_t index = acquire_slot();
+        call_slot& slot = *slots_[index];
+        std::uint64_t id = (std::uint64_t(slot.generation) << slot_index_bits) | index;
+        encode(slot.request, id, method, params);
+
+        outbox_.push_back(&slot.request);
+        write_signal_.cancel_one();
+
+        while (!slot.done) {
+            slot.timer.expires_at(net::steady_timer::time_point::max());
+            beast::error_code ec;
+            co_await slot.timer.async_wait(net::redirect_error(net::use_awaitable, ec));
+        }
+
+        beast::error_code ec = slot.ec;
+        json response = std::move(slot.response);
+        release_slot(index);
+        if (ec) {
+            throw beast::system_error(ec);
+        }
+        co_return response;
+    }
+
+    net::awaitable<void> close() {
+        if (!open_) {
+            co_return;
+        }
+        open_ = false;
+        write_signal_.cancel();
+        co_await ws_.async_close(websocket::close_code::normal, net::use_awaitable);
+    }
+
+private:
+    // ids are generation << 20 | slot index, which stays below 2^53 so they
+    // survive a round trip through a JSON double
+    static constexpr unsigned slot_index_bits = 20;
+
+    struct call_slot {
+        explicit call_slot(const executor_type& ex) : timer(ex) {}
+        net::steady_timer timer;
+        std::string request;      // capacity is kept across calls
+        json response;
+        beast::error_code ec;
+        std::uint32_t generation = 0;
+        bool done = false;
+    };
+
+    std::uint32_t acquire_slot() {
+        if (free_.empty()) {
+            slots_.push_back(std::make_unique<call_slot>(strand_));
+            free_.push_back(static_cast<std::uint32_t>(slots_.size() - 1));
+        }
+        std::uint32_t index = free_.back();
+        free_.pop_back();
+        slots_[index]->done = false;
+        slots_[index]->ec = {};
+        return index;
+    }
+
+    void release_slot(std::uint32_t index) {
+        ++slots_[index]->generation;
+        free_.push_back(index);
+    }
+
+    static void encode(std::string& out, std::uint64_t id, std::string_view method, const json& params) {
+        char digits[24];
+        auto res = std::to_chars(digits, digits + sizeof(digits), id);
+        out.clear();
+        out.append(R"({"jsonrpc":"2.0","id":)");
+        out.append(digits, res.ptr);
+        out.append(R"(,"method":")");
+        out.append(method);
+        out.append(R"(","params":)");
+        nlohmann::detail::serializer<json> s(nlohmann::detail::output_adapter<char>(out), ' ');
+        s.dump(params, false, false, 0);
+        out.push_back('}');
+    }
+
+    // Completes the call waiting for id; returns false if no call matches.
+    bool complete(std::uint64_t id, json& response) {
+        std::uint32_t index = static_cast<std::uint32_t>(id & ((1u << slot_index_bits) - 1));
+        if (index >= slots_.size()) {
+            return false;
+        }
+        call_slot& slot = *slots_[index];
+        if (slot.generation != static_cast<std::uint32_t>(id >> slot_index_bits) || slot.done) {
+            return false;
+        }
+        slot.response = std::move(response);
+        slot.done = true;
+        slot.timer.cancel();
+        return true;
+    }
+
+    void fail_pending(beast::error_code ec) {
+        for (auto& slot : slots_) {
+            if (!slot->done) {
+                slot->ec = ec;
+                slot->done = true;
+                slot->timer.cancel();
+            }
+        }
+    }
+
+    net::awaitable<void> read_loop() {
+        try {
+            for (;;) {
+                std::size_t n = co_await ws_.async_read(buffer_, net::use_awaitable);
+                std::string_view frame(static_cast<const char*>(buffer_.data().data()), n);
+                try {
+                    json j = json::parse(frame);
+                    auto id_it = j.find("id");
+                    if (!(id_it != j.end() && id_it->is_number_unsigned() && complete(id_it->get<std::uint64_t>(), j))
+                        && notification_handler_) {
+                        notification_handler_(j);
+                    }
+                } catch (const json::parse_error& e) {
+                    std::cerr << "JSON parse error: " << e.what() << "\n";
+                }
+                buffer_.consume(buffer_.size());
+            }
+        } catch (const beast::system_error& e) {
+            open_ = false;
+            write_signal_.cancel();
+            fail_pending(e.code());
+            if (e.code() != websocket::error::closed && e.code() != net::error::operation_aborted) {
+                fail(e.code(), "read");
+            }
+        }
+    }
+
+    net::awaitable<void> write_loop() {
+        try {
+            while (open_) {
+                if (outbox_.empty()) {
+                    write_signal_.expires_at(net::steady_timer::time_point::max());
+                    beast::error_code ec;
+                    co_await write_signal_.async_wait(net::redirect_error(net::use_awaitable, ec));
+                    continue;
+                }
+                co_await ws_.async_write(net::buffer(*outbox_.front()), net::use_awaitable);
+                outbox_.pop_front();
+            }
+        } catch (const beast::system_error& e) {
+            fail_pending(e.code());
+            fail(e.code(), "write");
+        }
+    }
+
+    executor_type strand_;
+    tcp::resolver resolver_;
+    websocket::stream<beast::ssl_stream<beast::tcp_stream>> ws_;
+    beast::flat_buffer buffer_;
+    net::steady_timer write_signal_;
+    std::deque<std::string*> outbox_;
+    std::vector<std::unique_ptr<call_slot>> slots_;
+    std::vector<std::uint32_t> free_;
+    std::function<void(json&)> notification_handler_;
+    bool open_ = false;
+};
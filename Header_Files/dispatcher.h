@@ -0,0 +1,511 @@
+#pragma once
+#include "json_rpc.h"
+#include "common.h"
+#include "thread_safe_queue.h"
+#include "arena.h"
+#include "clock_sync.h"
+#include "heartbeat.h"
+#include "channel_registry.h"
+#include "json_index.h"
+
+#include <cstring>
+#include <string_view>
+
+// Decodes one inbound frame and routes it: subscription notifications to the feed
+// queue, exchange heartbeats to the heartbeat handler, responses to the response
+// handler and then the inbox, and the first auth response to the access token. session::on_read drives it for live traffic and the
+// replay engine drives it for recorded frames, so both take exactly the same path.
+// Not thread-safe; the owner calls dispatch() from a single strand or thread.
+//
+// With a synchronised clock, every message carrying an exchange timestamp (usOut
+// on responses, data.timestamp on notifications) is stamped with
+// "one_way_delay_us": local receive time on the exchange clock minus that
+// timestamp. The delays also feed a per-dispatcher latency series.
+//
+// decode_mode::arena parses each frame into a frame_json backed by a per-dispatcher
+// monotonic arena that is reset in one shot after routing. Messages that outlive
+// the frame (queued or handed to response handlers) are copied into heap json.
+//
+// decode_mode::index builds a structural index of the frame (json_index.h) and
+// reads method and the exchange timestamp through it; the DOM for handlers and
+// queues is then built from the same index instead of by nlohmann's parser.
+//
+// decode_mode::lazy only classifies each frame (classify_frame): notifications
+// are queued as raw text and parsed by the consumer that pops them (lazy_json),
+// so the read strand pays a scan of the first bytes and a copy per notification.
+// Responses and heartbeats, which are handled on the strand, and notifications
+// for a notification handler are still decoded here. One-way delays of queued
+// notifications are stamped when they are decoded and do not enter the
+// dispatcher's latency series.
+//
+// With a channel_registry, notifications on interned channels are routed by one
+// hash lookup of params.channel; other channels take the conflation prefix scan.
+enum class decode_mode { heap, arena, index, lazy };
+
+// Builds configured with -DOEMS_JSON_INDEX=ON decode with the structural index
+// unless --decode says otherwise.
+#ifdef OEMS_JSON_INDEX
+inline constexpr decode_mode default_decode_mode = decode_mode::index;
+#else
+inline constexpr decode_mode default_decode_mode = decode_mode::heap;
+#endif
+
+inline decode_mode parse_decode_mode(const std::string& name) {
+    if (name == "heap") return decode_mode::heap;
+    if (name == "arena") return decode_mode::arena;
+    if (name == "index") return decode_mode::index;
+    if (name == "lazy") return decode_mode::lazy;
+    throw std::invalid_argument("Invalid decode mode '" + name + "'. Must be 'heap', 'arena', 'index' or 'lazy'.");
+}
+
+// Top-level scanning of frame text without decoding it. Positions are byte
+// offsets into the frame; npos marks text the scanner cannot follow.
+namespace frame_scan {
+
+constexpr std::size_t npos = std::string_view::npos;
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline std::size_t skip_space(std::string_view s, std::size_t i) {
+    while (i < s.size() && is_space(s[i])) {
+        ++i;
+    }
+    return i;
+}
+
+// i at an opening quote; returns the offset after the closing one.
+inline std::size_t skip_string(std::string_view s, std::size_t i) {
+    for (++i; i < s.size();) {
+        const void* quote = std::memchr(s.data() + i, '"', s.size() - i);
+        if (!quote) {
+            return npos;
+        }
+        const std::size_t q = static_cast<const char*>(quote) - s.data();
+        std::size_t run = q;
+        while (run > i && s[run - 1] == '\\') {
+            --run;
+        }
+        // an even run of backslashes escapes itself, not the quote
+        if ((q - run) % 2 == 0) {
+            return q + 1;
+        }
+        i = q + 1;
+    }
+    return npos;
+}
+
+// i at the first character of a value; returns the offset after it.
+inline std::size_t skip_value(std::string_view s, std::size_t i) {
+    if (i >= s.size()) {
+        return npos;
+    }
+    if (s[i] == '"') {
+        return skip_string(s, i);
+    }
+    if (s[i] == '{' || s[i] == '[') {
+        std::size_t depth = 0;
+        while (i < s.size()) {
+            const char c = s[i];
+            if (c == '"') {
+                i = skip_string(s, i);
+                if (i == npos) {
+                    return npos;
+                }
+                continue;
+            }
+            if (c == '{' || c == '[') {
+                ++depth;
+            } else if ((c == '}' || c == ']') && --depth == 0) {
+                return i + 1;
+            }
+            ++i;
+        }
+        return npos;
+    }
+    while (i < s.size() && s[i] != ',' && s[i] != '}' && s[i] != ']' && !is_space(s[i])) {
+        ++i;
+    }
+    return i;
+}
+
+// Contents of the string value at i, escapes untouched; empty if i is not a string.
+inline std::string_view string_at(std::string_view s, std::size_t i) {
+    if (i >= s.size() || s[i] != '"') {
+        return {};
+    }
+    const std::size_t end = skip_string(s, i);
+    return end == npos ? std::string_view() : s.substr(i + 1, end - i - 2);
+}
+
+// f(key, value offset) for the members of the object at i, until f returns false.
+template<class F>
+void for_each_member(std::string_view s, std::size_t i, F&& f) {
+    i = skip_space(s, i);
+    if (i >= s.size() || s[i] != '{') {
+        return;
+    }
+    i = skip_space(s, i + 1);
+    while (i < s.size() && s[i] == '"') {
+        const std::size_t key_end = skip_string(s, i);
+        if (key_end == npos) {
+            return;
+        }
+        const std::string_view key = s.substr(i + 1, key_end - i - 2);
+        i = skip_space(s, key_end);
+        if (i >= s.size() || s[i] != ':') {
+            return;
+        }
+        i = skip_space(s, i + 1);
+        if (!f(key, i)) {
+            return;
+        }
+        i = skip_space(s, skip_value(s, i));
+        if (i >= s.size() || s[i] != ',') {
+            return;
+        }
+        i = skip_space(s, i + 1);
+    }
+}
+
+} // namespace frame_scan
+
+enum class frame_kind { notification, other };
+
+struct frame_class {
+    frame_kind kind = frame_kind::other;
+    std::string_view channel;   // params.channel of a notification, a view into the frame
+};
+
+// Classifies a frame from its top-level keys: "method":"subscription" with a
+// params.channel string is a notification, anything else (responses, heartbeats,
+// text the scanner cannot follow) is left to the parser. Deribit sends method and
+// params.channel ahead of the data, so the scan stops after the first hundred or
+// so bytes of a notification and never looks at its payload.
+inline frame_class classify_frame(std::string_view frame) {
+    // the exchange's own key order, checked with one compare before the general scan
+    constexpr std::string_view deribit_prefix = R"({"jsonrpc":"2.0","method":"subscription","params":{"channel":")";
+    if (frame.starts_with(deribit_prefix)) {
+        const std::size_t end = frame.find('"', deribit_prefix.size());
+        const std::string_view channel = frame.substr(deribit_prefix.size(), end - deribit_prefix.size());
+        if (end != std::string_view::npos && !channel.empty() && channel.find('\\') == std::string_view::npos) {
+            return {frame_kind::notification, channel};
+        }
+    }
+    std::string_view method, channel;
+    bool response = false;
+    frame_scan::for_each_member(frame, 0, [&](std::string_view key, std::size_t value) {
+        if (key == "method") {
+            method = frame_scan::string_at(frame, value);
+        } else if (key == "params") {
+            frame_scan::for_each_member(frame, value, [&](std::string_view k, std::size_t v) {
+                if (k == "channel") {
+                    channel = frame_scan::string_at(frame, v);
+                    return false;
+                }
+                return true;
+            });
+        } else if (key == "id" || key == "result" || key == "error") {
+            response = true;
+            return false;
+        }
+        return method.empty() || (method == "subscription" && channel.empty());
+    });
+    if (!response && method == "subscription" && !channel.empty()) {
+        return {frame_kind::notification, channel};
+    }
+    return {};
+}
+
+class frame_dispatcher {
+public:
+    frame_dispatcher(RpcQueue& inbox, RpcQueue& feedQueue)
+        : inbox_(inbox)
+        , feedQueue_(feedQueue)
+    {
+    }
+
+    // Called for every RPC response. Returning true consumes the response,
+    // otherwise it continues to the inbox.
+    void set_response_handler(std::function<bool(const json&)> handler) {
+        response_handler_ = std::move(handler);
+    }
+
+    // Called for every subscription notification. Returning true consumes it,
+    // otherwise it continues to the conflated or feed queue.
+    void set_notification_handler(std::function<bool(const json&)> handler) {
+        notification_handler_ = std::move(handler);
+    }
+
+    // Called for every "heartbeat" notification; they never reach the queues.
+    void set_heartbeat_handler(std::function<void(const json&)> handler) {
+        heartbeat_handler_ = std::move(handler);
+    }
+
+    // Routes subscription notifications whose channel starts with one of prefixes
+    // into the last-value queue instead of the FIFO feed queue.
+    void set_conflation(ConflatedFeed* queue, std::vector<std::string> prefixes) {
+        conflated_ = queue;
+        conflated_prefixes_ = std::move(prefixes);
+    }
+
+    // Routes interned channels by their registry entry instead of by prefix.
+    void set_channel_registry(std::shared_ptr<const channel_registry> channels) {
+        channels_ = std::move(channels);
+        channel_version_ = ~std::uint64_t(0);
+    }
+
+    // Called when a queue configured with overflow_policy::disconnect is full.
+    void set_overflow_handler(std::function<void(const char*)> handler) {
+        overflow_handler_ = std::move(handler);
+    }
+
+    // Enables one-way delay stamping; dispatch() must then be given receive times.
+    void set_clock_sync(std::shared_ptr<const ClockSync> clock) {
+        clock_ = std::move(clock);
+    }
+
+    latency_summary one_way_delay() const {
+        return one_way_delay_.summary();
+    }
+
+    // Diagnostics for auth/parse problems; off for replay.
+    void set_verbose(bool verbose) {
+        verbose_ = verbose;
+    }
+
+    void set_decode_mode(decode_mode mode) {
+        mode_ = mode;
+    }
+
+    decode_mode mode() const {
+        return mode_;
+    }
+
+    const std::string& access_token() const {
+        return access_token_;
+    }
+
+    std::uint64_t frames() const { return frames_; }
+    std::uint64_t parse_errors() const { return parse_errors_; }
+
+    // received_ns is the local wall-clock receive time (ClockSync::now_ns()), 0 if unknown.
+    void dispatch(std::string_view frame, std::int64_t received_ns = 0) {
+        ++frames_;
+        received_ns_ = received_ns;
+        try {
+            if (mode_ == decode_mode::arena) {
+                dispatch_arena(frame);
+                return;
+            }
+            if (mode_ == decode_mode::index) {
+                dispatch_index(frame);
+                return;
+            }
+            if (mode_ == decode_mode::lazy) {
+                dispatch_lazy(frame);
+                return;
+            }
+            json j = json::parse(frame);
+            stamp_and_route(j);
+        } catch (const json::parse_error& e) {
+            ++parse_errors_;
+            if (verbose_) {
+                std::cerr << "JSON parse error: " << e.what() << "\n";
+            }
+        } catch (const json_index_error& e) {
+            ++parse_errors_;
+            if (verbose_) {
+                std::cerr << "JSON parse error: " << e.what() << "\n";
+            }
+        }
+    }
+
+private:
+    void dispatch_arena(std::string_view frame) {
+        arena_scope scope(arena_);
+        frame_json doc = frame_json::parse(frame);
+        json j = to_heap_json(doc);
+        stamp_and_route(j);
+    }
+
+    void dispatch_index(std::string_view frame) {
+        index_.parse(frame);
+        const json_element root = index_.root();
+        std::optional<std::int64_t> sent_us;
+        if (clock_ && received_ns_ != 0) {
+            sent_us = indexed_send_us(root);
+        }
+        std::string_view method;
+        if (auto m = root.find("method"); m && m->is_string()) {
+            method = m->raw_string();
+        }
+        json j = index_.to_json();
+        if (sent_us) {
+            stamp_delay(j, *sent_us);
+        }
+        route(j, method);
+    }
+
+    void dispatch_lazy(std::string_view frame) {
+        frame_class c = classify_frame(frame);
+        if (c.kind == frame_kind::notification && !notification_handler_) {
+            std::shared_ptr<const ClockSync> clock = received_ns_ != 0 ? clock_ : nullptr;
+            route_notification(c.channel, lazy_json(frame, received_ns_, std::move(clock)));
+            return;
+        }
+        json j = json::parse(frame);
+        stamp_and_route(j);
+    }
+
+    void stamp_and_route(json& j) {
+        if (clock_ && received_ns_ != 0) {
+            if (auto sent_us = exchange_send_us(j)) {
+                stamp_delay(j, *sent_us);
+            }
+        }
+        auto method_it = j.find("method");
+        route(j, method_it != j.end() && method_it->is_string()
+                     ? std::string_view(method_it->get_ref<const std::string&>()) : std::string_view());
+    }
+
+    void route(json& j, std::string_view method) {
+        if (method == "subscription") {
+            route_subscription(j);
+        }else if (method == "heartbeat") {
+            if (heartbeat_handler_) {
+                heartbeat_handler_(j);
+            }
+        }else{
+            route_response(j);
+        }
+    }
+
+    void route_subscription(json& j) {
+        if (notification_handler_ && notification_handler_(j)) {
+            return;
+        }
+        // the channel string lives in j's heap storage, which moving j keeps intact
+        route_notification(channel_of(j), lazy_json(std::move(j)));
+    }
+
+    void route_notification(std::string_view channel, lazy_json msg) {
+        if (channels_) {
+            if (const channel_entry* e = find_channel(channel)) {
+                if (e->route == channel_route::conflated && conflated_) {
+                    conflated_->push(e->name, std::move(msg));
+                    return;
+                }
+                check_overflow(feedQueue_.push(std::move(msg)), "feed");
+                return;
+            }
+        }
+        if (conflated_ && !channel.empty()) {
+            for (const auto& prefix : conflated_prefixes_) {
+                if (channel.starts_with(prefix)) {
+                    std::string key(channel);
+                    conflated_->push(key, std::move(msg));
+                    return;
+                }
+            }
+        }
+        check_overflow(feedQueue_.push(std::move(msg)), "feed");
+    }
+
+    void route_response(json& j) {
+        if (response_handler_ && response_handler_(j)) {
+            // consumed by the handler
+        }else if (access_token_.empty()) {
+            if (j.contains("result") && j["result"].contains("access_token")) {
+                access_token_ = j["result"]["access_token"];
+                if (verbose_) {
+                    std::cout << "Access token set successfully.\n";
+                }
+            } else if (verbose_) {
+                std::cerr << "Error: No access token found in response, Authentication required.\n";
+            }
+        }else{
+            check_overflow(inbox_.push(std::move(j)), "inbox");
+        }
+    }
+
+    // exchange_send_us (lazy_json.h) read through the structural index.
+    static std::optional<std::int64_t> indexed_send_us(const json_element& root) {
+        if (auto us_out = root.find("usOut"); us_out && us_out->is_number()) {
+            return static_cast<std::int64_t>(us_out->get_double());
+        }
+        auto params = root.find("params");
+        auto data = params ? params->find("data") : std::nullopt;
+        if (!data) {
+            return std::nullopt;
+        }
+        std::optional<json_element> latest = data;
+        if (data->is_array()) {
+            data->for_each_element([&](json_element e) { latest = e; });
+        }
+        auto ts = latest->find("timestamp");
+        if (!ts || !ts->is_number()) {
+            return std::nullopt;
+        }
+        return static_cast<std::int64_t>(ts->get_double()) * 1000;
+    }
+
+    void stamp_delay(json& j, std::int64_t sent_us) {
+        if (!clock_->synced()) {
+            return;
+        }
+        std::int64_t delay_us = clock_->to_exchange_us(received_ns_) - sent_us;
+        j["one_way_delay_us"] = delay_us;
+        one_way_delay_.record(std::chrono::microseconds(delay_us));
+    }
+
+    void check_overflow(push_result result, const char* queue) {
+        if (result == push_result::overflow && overflow_handler_) {
+            overflow_handler_(queue);
+        }
+    }
+
+    static std::string_view channel_of(const json& j) {
+        auto params_it = j.find("params");
+        if (params_it == j.end() || !params_it->is_object()) {
+            return {};
+        }
+        auto channel_it = params_it->find("channel");
+        if (channel_it == params_it->end() || !channel_it->is_string()) {
+            return {};
+        }
+        return channel_it->get_ref<const std::string&>();
+    }
+
+    const channel_entry* find_channel(std::string_view channel) {
+        std::uint64_t version = channels_->version();
+        if (version != channel_version_) {
+            channel_table_ = channels_->table();
+            channel_version_ = version;
+        }
+        return channel.empty() ? nullptr : channel_table_->find(channel);
+    }
+
+    RpcQueue& inbox_;
+    RpcQueue& feedQueue_;
+    std::string access_token_;
+    std::function<bool(const json&)> response_handler_;
+    std::function<bool(const json&)> notification_handler_;
+    std::function<void(const json&)> heartbeat_handler_;
+    std::function<void(const char*)> overflow_handler_;
+    std::shared_ptr<const ClockSync> clock_;
+    std::int64_t received_ns_ = 0;
+    latency_series one_way_delay_;
+    ConflatedFeed* conflated_ = nullptr;
+    std::vector<std::string> conflated_prefixes_;
+    std::shared_ptr<const channel_registry> channels_;
+    std::shared_ptr<const channel_table> channel_table_;
+    std::uint64_t channel_version_ = 0;
+    bool verbose_ = true;
+    decode_mode mode_ = default_decode_mode;
+    monotonic_arena arena_;
+    json_document index_;
+    std::uint64_t frames_ = 0;
+    std::uint64_t parse_errors_ = 0;
+};
@@ -0,0 +1,452 @@
+#pragma once
+#include "common.h"
+#include "symbol_table.h"
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OEMS_HAVE_SIMD_DECIMAL 1
+#endif
+
+// Integer fixed-point prices and quantities.
+// A Price counts ticks and a Qty counts lots of one instrument, so book keys and
+// comparisons are plain integer operations and tick/lot validation is exact.
+// The decimal value of a tick or lot is described by a decimal_step.
+
+// step = mantissa * 10^-exponent, e.g. 0.5 -> {5, 1}, 0.0005 -> {5, 4}
+struct decimal_step {
+    std::int64_t mantissa = 1;
+    std::uint8_t exponent = 0;
+};
+
+constexpr std::uint8_t max_decimal_exponent = 12;
+
+constexpr std::int64_t pow10_table[max_decimal_exponent + 1] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL,
+    100000000LL, 1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL,
+};
+
+template <typename Tag>
+class fixed {
+public:
+    constexpr fixed() = default;
+    constexpr explicit fixed(std::int64_t units) : units_(units) {}
+
+    constexpr std::int64_t units() const { return units_; }
+
+    constexpr fixed operator+(fixed o) const { return fixed(units_ + o.units_); }
+    constexpr fixed operator-(fixed o) const { return fixed(units_ - o.units_); }
+    constexpr fixed& operator+=(fixed o) { units_ += o.units_; return *this; }
+    constexpr fixed& operator-=(fixed o) { units_ -= o.units_; return *this; }
+
+    constexpr bool operator==(fixed o) const { return units_ == o.units_; }
+    constexpr bool operator!=(fixed o) const { return units_ != o.units_; }
+    constexpr bool operator<(fixed o) const { return units_ < o.units_; }
+    constexpr bool operator>(fixed o) const { return units_ > o.units_; }
+    constexpr bool operator<=(fixed o) const { return units_ <= o.units_; }
+    constexpr bool operator>=(fixed o) const { return units_ >= o.units_; }
+
+private:
+    std::int64_t units_ = 0;
+};
+
+struct price_tag {};
+struct qty_tag {};
+using Price = fixed<price_tag>;   // number of ticks
+using Qty = fixed<qty_tag>;       // number of lots
+
+enum class rounding { exact, nearest, down, up };
+
+// Parses a plain decimal ("123", "-0.25", "1e-4" is not accepted) into an integer
+// scaled by 10^exponent. Fails on malformed input, overflow, or when non-zero digits
+// would be lost (more fractional digits than exponent).
+// This is the reference implementation; parse_decimal below gives the same results.
+inline bool parse_decimal_scalar(std::string_view s, std::uint8_t exponent, std::int64_t& out) {
+    if (s.empty() || exponent > max_decimal_exponent) {
+        return false;
+    }
+    std::size_t i = 0;
+    bool negative = false;
+    if (s[0] == '-' || s[0] == '+') {
+        negative = s[0] == '-';
+        ++i;
+    }
+    std::uint64_t value = 0;
+    std::size_t int_digits = 0;
+    for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i, ++int_digits) {
+        if (value > (std::numeric_limits<std::int64_t>::max() - 9) / 10) {
+            return false;
+        }
+        value = value * 10 + static_cast<unsigned>(s[i] - '0');
+    }
+    std::uint8_t frac_digits = 0;
+    std::size_t digits = int_digits;
+    if (i < s.size() && s[i] == '.') {
+        ++i;
+        for (; i < s.size() && s[i] >= '0' && s[i] <= '9'; ++i, ++digits) {
+            if (frac_digits == exponent) {
+                if (s[i] != '0') {
+                    return false;
+                }
+                continue;
+            }
+            if (value > (std::numeric_limits<std::int64_t>::max() - 9) / 10) {
+                return false;
+            }
+            value = value * 10 + static_cast<unsigned>(s[i] - '0');
+            ++frac_digits;
+        }
+    }
+    if (i != s.size() || digits == 0) {
+        return false;
+    }
+    std::int64_t scale = pow10_table[exponent - frac_digits];
+    if (value > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max() / scale)) {
+        return false;
+    }
+    std::int64_t scaled = static_cast<std::int64_t>(value) * scale;
+    out = negative ? -scaled : scaled;
+    return true;
+}
+
+// Vectorized parsing of the short decimals that make up feed payloads (prices,
+// amounts, greeks: rarely more than 16 characters). One 16-byte load classifies
+// digits and the point, a shuffle right-aligns the digits and drops the point,
+// and three multiply-adds fold them into an integer. Longer or malformed text
+// takes the scalar path. SSE4.1 is checked at run time.
+namespace decimal_simd {
+
+struct digits {
+    std::uint64_t value = 0;        // all digits, point removed
+    std::uint8_t frac_digits = 0;
+};
+
+#ifdef OEMS_HAVE_SIMD_DECIMAL
+// Parses digits[.digits] filling exactly len (1..16) bytes at p.
+__attribute__((target("sse4.1")))
+inline bool scan16(const char* p, std::size_t len, digits& out) {
+    // a full 16-byte load must not cross into a page that may be unmapped
+    char copy[16];
+    const char* src = p;
+    if ((reinterpret_cast<std::uintptr_t>(p) & 4095) > 4096 - 16) {
+        std::memcpy(copy, p, len);
+        src = copy;
+    }
+    const __m128i nine = _mm_set1_epi8(9);
+    __m128i d = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)), _mm_set1_epi8('0'));
+    unsigned digit_mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(d, nine), nine)));
+    digit_mask &= (1u << len) - 1;
+
+    const auto int_len = static_cast<unsigned>(std::countr_one(digit_mask));
+    unsigned frac_len = 0;
+    if (int_len < len) {
+        if (p[int_len] != '.') {
+            return false;
+        }
+        frac_len = static_cast<unsigned>(std::countr_one(digit_mask >> (int_len + 1)));
+        if (int_len + 1 + frac_len != len) {
+            return false;
+        }
+    }
+    const unsigned n = int_len + frac_len;
+    if (n == 0) {
+        return false;
+    }
+
+    // output lane j takes digit k = j - (16 - n), found at byte k, or k + 1 past the point;
+    // lanes with k < 0 get an index with the high bit set, which the shuffle zeroes
+    __m128i k = _mm_sub_epi8(_mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+                             _mm_set1_epi8(static_cast<char>(16 - n)));
+    __m128i idx = _mm_sub_epi8(k, _mm_cmpgt_epi8(k, _mm_set1_epi8(static_cast<char>(int_len - 1))));
+    idx = _mm_or_si128(idx, _mm_cmpgt_epi8(_mm_setzero_si128(), k));
+    __m128i x = _mm_shuffle_epi8(d, idx);
+
+    x = _mm_maddubs_epi16(x, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+    x = _mm_madd_epi16(x, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+    x = _mm_packus_epi32(x, x);
+    x = _mm_madd_epi16(x, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+    out.value = static_cast<std::uint64_t>(_mm_cvtsi128_si32(x)) * 100000000ull +
+                static_cast<std::uint32_t>(_mm_extract_epi32(x, 1));
+    out.frac_digits = static_cast<std::uint8_t>(frac_len);
+    return true;
+}
+
+inline const bool has_sse41 = __builtin_cpu_supports("sse4.1");
+#endif
+
+constexpr std::uint64_t pow10_u64[17] = {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+    1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+    100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+};
+
+} // namespace decimal_simd
+
+// Same contract as parse_decimal_scalar.
+inline bool parse_decimal(std::string_view s, std::uint8_t exponent, std::int64_t& out) {
+#ifdef OEMS_HAVE_SIMD_DECIMAL
+    const std::size_t sign = !s.empty() && (s[0] == '-' || s[0] == '+') ? 1 : 0;
+    const std::size_t len = s.size() - sign;
+    if (decimal_simd::has_sse41 && len >= 1 && len <= 16 && exponent <= max_decimal_exponent) {
+        decimal_simd::digits d;
+        if (!decimal_simd::scan16(s.data() + sign, len, d)) {
+            return false;
+        }
+        std::uint64_t value = d.value;
+        if (d.frac_digits > exponent) {
+            // the digits past the exponent must all be zero
+            std::uint64_t drop = decimal_simd::pow10_u64[d.frac_digits - exponent];
+            if (value % drop != 0) {
+                return false;
+            }
+            value /= drop;
+        } else {
+            std::int64_t scale = pow10_table[exponent - d.frac_digits];
+            if (value > static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max() / scale)) {
+                return false;
+            }
+            value *= static_cast<std::uint64_t>(scale);
+        }
+        out = s[0] == '-' ? -static_cast<std::int64_t>(value) : static_cast<std::int64_t>(value);
+        return true;
+    }
+#endif
+    return parse_decimal_scalar(s, exponent, out);
+}
+
+// Parses a JSON number into the nearest double, as std::from_chars does. Plain
+// decimals of up to 16 characters whose digits fit in 53 bits take the SIMD scan
+// and one correctly rounded division by an exact power of ten; anything else
+// (exponents, long mantissas) goes to std::from_chars.
+inline bool parse_double(std::string_view s, double& out) {
+#ifdef OEMS_HAVE_SIMD_DECIMAL
+    const std::size_t sign = !s.empty() && s[0] == '-' ? 1 : 0;
+    const std::size_t len = s.size() - sign;
+    decimal_simd::digits d;
+    if (decimal_simd::has_sse41 && len >= 1 && len <= 16 && decimal_simd::scan16(s.data() + sign, len, d) &&
+        d.value <= (std::uint64_t(1) << 53)) {
+        static constexpr double pow10_double[17] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16,
+        };
+        double value = static_cast<double>(d.value) / pow10_double[d.frac_digits];
+        out = sign ? -value : value;
+        return true;
+    }
+#endif
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && end == s.data() + s.size();
+}
+
+// Converts a double to an integer scaled by 10^exponent, rounding to the nearest unit.
+// Exact for any value that was itself parsed from a decimal with at most 15 significant digits.
+inline std::int64_t double_to_scaled(double value, std::uint8_t exponent) {
+    return std::llround(value * static_cast<double>(pow10_table[exponent]));
+}
+
+// Writes scaled / 10^exponent as a decimal without trailing zeros. Returns the number
+// of characters written; buf must hold at least 24 characters.
+inline std::size_t format_decimal(std::int64_t scaled, std::uint8_t exponent, char* buf) {
+    char tmp[24];
+    std::size_t n = 0;
+    bool negative = scaled < 0;
+    std::uint64_t v = negative ? 0 - static_cast<std::uint64_t>(scaled) : static_cast<std::uint64_t>(scaled);
+
+    // drop trailing fractional zeros up front so they are never emitted
+    while (exponent > 0 && v % 10 == 0 && v != 0) {
+        v /= 10;
+        --exponent;
+    }
+    if (v == 0) {
+        exponent = 0;
+    }
+
+    do {
+        tmp[n++] = static_cast<char>('0' + v % 10);
+        v /= 10;
+        if (n == exponent) {
+            tmp[n++] = '.';
+            if (v == 0) {
+                tmp[n++] = '0';
+            }
+        }
+    } while (v != 0 || n < exponent);
+
+    std::size_t len = 0;
+    if (negative) {
+        buf[len++] = '-';
+    }
+    while (n > 0) {
+        buf[len++] = tmp[--n];
+    }
+    return len;
+}
+
+inline std::string format_decimal(std::int64_t scaled, std::uint8_t exponent) {
+    char buf[24];
+    return std::string(buf, format_decimal(scaled, exponent, buf));
+}
+
+// Converts a value scaled by 10^step.exponent into whole steps.
+// With rounding::exact, returns false when the value is not a multiple of the step.
+inline bool scaled_to_steps(std::int64_t scaled, decimal_step step, rounding mode, std::int64_t& steps) {
+    std::int64_t q = scaled / step.mantissa;
+    std::int64_t r = scaled % step.mantissa;
+    if (r == 0) {
+        steps = q;
+        return true;
+    }
+    switch (mode) {
+        case rounding::exact:
+            return false;
+        case rounding::down:
+            steps = r < 0 ? q - 1 : q;
+            return true;
+        case rounding::up:
+            steps = r > 0 ? q + 1 : q;
+            return true;
+        case rounding::nearest:
+            steps = (2 * (r < 0 ? -r : r) >= step.mantissa) ? (r < 0 ? q - 1 : q + 1) : q;
+            return true;
+    }
+    return false;
+}
+
+// Tick and lot description of one instrument.
+struct instrument_scale {
+    decimal_step tick;
+    decimal_step lot;
+
+    bool to_price(double value, rounding mode, Price& out) const {
+        std::int64_t steps;
+        if (!scaled_to_steps(double_to_scaled(value, tick.exponent), tick, mode, steps)) {
+            return false;
+        }
+        out = Price(steps);
+        return true;
+    }
+
+    bool to_qty(double value, rounding mode, Qty& out) const {
+        std::int64_t steps;
+        if (!scaled_to_steps(double_to_scaled(value, lot.exponent), lot, mode, steps)) {
+            return false;
+        }
+        out = Qty(steps);
+        return true;
+    }
+
+    // Parses a price straight from feed/response text, e.g. the bytes of a JSON number.
+    bool parse_price(std::string_view text, rounding mode, Price& out) const {
+        std::int64_t scaled, steps;
+        if (!parse_decimal(text, tick.exponent, scaled) || !scaled_to_steps(scaled, tick, mode, steps)) {
+            return false;
+        }
+        out = Price(steps);
+        return true;
+    }
+
+    bool parse_qty(std::string_view text, rounding mode, Qty& out) const {
+        std::int64_t scaled, steps;
+        if (!parse_decimal(text, lot.exponent, scaled) || !scaled_to_steps(scaled, lot, mode, steps)) {
+            return false;
+        }
+        out = Qty(steps);
+        return true;
+    }
+
+    double to_double(Price p) const {
+        return static_cast<double>(p.units() * tick.mantissa) / static_cast<double>(pow10_table[tick.exponent]);
+    }
+
+    double to_double(Qty q) const {
+        return static_cast<double>(q.units() * lot.mantissa) / static_cast<double>(pow10_table[lot.exponent]);
+    }
+
+    std::size_t format(Price p, char* buf) const {
+        return format_decimal(p.units() * tick.mantissa, tick.exponent, buf);
+    }
+
+    std::size_t format(Qty q, char* buf) const {
+        return format_decimal(q.units() * lot.mantissa, lot.exponent, buf);
+    }
+
+    std::string tick_string() const { return format_decimal(tick.mantissa, tick.exponent); }
+    std::string lot_string() const { return format_decimal(lot.mantissa, lot.exponent); }
+};
+
+// Converts a decimal such as 0.0005 into a decimal_step. Returns false when the value
+// needs more than max_decimal_exponent fractional digits or is not positive.
+inline bool make_decimal_step(double value, decimal_step& out) {
+    if (!(value > 0)) {
+        return false;
+    }
+    for (std::uint8_t e = 0; e <= max_decimal_exponent; ++e) {
+        double scaled = value * static_cast<double>(pow10_table[e]);
+        std::int64_t m = std::llround(scaled);
+        if (m > 0 && std::fabs(scaled - static_cast<double>(m)) < 1e-9 * scaled) {
+            out = decimal_step{m, e};
+            return true;
+        }
+    }
+    return false;
+}
+
+// Per-instrument tick/lot table indexed by instrument id. Entries set explicitly
+// (e.g. from public/get_instruments) win; otherwise the scale is derived from the
+// instrument naming scheme.
+class TickTable {
+public:
+    void set(instrument_id id, instrument_scale scale) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (id >= scales_.size()) {
+            scales_.resize(id + 1);
+        }
+        scales_[id] = scale;
+    }
+
+    instrument_scale lookup(instrument_id id) const {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (id < scales_.size() && scales_[id]) {
+                return *scales_[id];
+            }
+        }
+        return default_scale(instrument_symbols().name(id));
+    }
+
+    // Names never seen before fall back to the naming scheme without being interned.
+    instrument_scale lookup(std::string_view instrument_name) const {
+        if (auto id = instrument_symbols().find(instrument_name)) {
+            return lookup(*id);
+        }
+        return default_scale(instrument_name);
+    }
+
+    // Exchange defaults by currency and kind, used until instrument metadata is loaded.
+    static instrument_scale default_scale(std::string_view instrument_name) {
+        auto dash = instrument_name.find('-');
+        std::string_view currency = instrument_name.substr(0, dash);
+        bool perpetual = instrument_name.find("PERPETUAL") != std::string_view::npos;
+        bool option = instrument_name.ends_with("-C") || instrument_name.ends_with("-P");
+        bool future = dash != std::string_view::npos && !perpetual && !option;
+
+        if (currency == "BTC") {
+            if (option) return {{5, 4}, {1, 1}};       // 0.0005 BTC, 0.1 contract
+            if (perpetual) return {{5, 1}, {10, 0}};   // 0.5 USD, 10 USD
+            if (future) return {{25, 1}, {10, 0}};     // 2.5 USD, 10 USD
+        } else if (currency == "ETH") {
+            if (option) return {{5, 4}, {1, 0}};       // 0.0005 ETH, 1 contract
+            if (perpetual) return {{5, 2}, {1, 0}};    // 0.05 USD, 1 USD
+            if (future) return {{25, 2}, {1, 0}};      // 0.25 USD, 1 USD
+        }
+        // unknown instrument: accept up to 8 decimals rather than guess a coarser grid
+        return {{1, 8}, {1, 8}};
+    }
+
+private:
+    mutable std::mutex mtx_;
+    std::vector<std::optional<instrument_scale>> scales_;
+};
@@ -0,0 +1,134 @@
+#pragma once
+#include "common.h"
+
+#include <atomic>
+
+// Recycling memory for the intermediate and completion handlers of one chain of
+// asynchronous operations (e.g. a session's read loop). Freed blocks are kept in a
+// small cache and handed back to the next operation, so once warmed up a steady
+// read or write loop no longer touches the global heap.
+//
+// Not thread-safe: each operation chain needs its own handler_memory. Asio orders
+// the allocations of a single chain, so no locking is needed.
+class handler_memory {
+public:
+    handler_memory() = default;
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+
+    ~handler_memory() {
+        for (std::size_t i = 0; i < cached_; ++i) {
+            ::operator delete(cache_[i]);
+        }
+    }
+
+    void* allocate(std::size_t size) {
+        for (std::size_t i = 0; i < cached_; ++i) {
+            header* h = static_cast<header*>(cache_[i]);
+            if (h->capacity >= size) {
+                cache_[i] = cache_[--cached_];
+                reused_.fetch_add(1, std::memory_order_relaxed);
+                return h + 1;
+            }
+        }
+        std::size_t capacity = (size + 63) & ~std::size_t(63);
+        header* h = static_cast<header*>(::operator new(sizeof(header) + capacity));
+        h->capacity = capacity;
+        heap_.fetch_add(1, std::memory_order_relaxed);
+        return h + 1;
+    }
+
+    void deallocate(void* p) {
+        header* h = static_cast<header*>(p) - 1;
+        if (cached_ < cache_.size()) {
+            cache_[cached_++] = h;
+            return;
+        }
+        ::operator delete(h);
+    }
+
+    std::uint64_t heap_allocations() const { return heap_.load(std::memory_order_relaxed); }
+    std::uint64_t reused_allocations() const { return reused_.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(std::max_align_t) header {
+        std::size_t capacity;
+    };
+
+    std::array<void*, 8> cache_{};
+    std::size_t cached_ = 0;
+    std::atomic<std::uint64_t> heap_{0};
+    std::atomic<std::uint64_t> reused_{0};
+};
+
+// Standard allocator over a handler_memory, exposed to Asio as the associated allocator.
+template <typename T>
+class handler_allocator {
+public:
+    using value_type = T;
+
+    explicit handler_allocator(handler_memory& mem)
+        : memory_(&mem)
+    {
+    }
+
+    template <typename U>
+    handler_allocator(const handler_allocator<U>& other) noexcept
+        : memory_(other.memory_)
+    {
+    }
+
+    T* allocate(std::size_t n) const {
+        return static_cast<T*>(memory_->allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* p, std::size_t) const {
+        memory_->deallocate(p);
+    }
+
+    bool operator==(const handler_allocator& other) const noexcept { return memory_ == other.memory_; }
+    bool operator!=(const handler_allocator& other) const noexcept { return memory_ != other.memory_; }
+
+private:
+    template <typename> friend class handler_allocator;
+    handler_memory* memory_;
+};
+
+// Completion handler wrapper that associates an executor and a handler_memory
+// with a plain function object, replacing bind_executor(bind_front_handler(...)).
+template <typename Executor, typename Handler>
+class recycling_handler {
+public:
+    using executor_type = Executor;
+    using allocator_type = handler_allocator<Handler>;
+
+    recycling_handler(const Executor& ex, handler_memory& mem, Handler h)
+        : executor_(ex)
+        , memory_(mem)
+        , handler_(std::move(h))
+    {
+    }
+
+    executor_type get_executor() const noexcept {
+        return executor_;
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type(memory_);
+    }
+
+    template <typename... Args>
+    void operator()(Args&&... args) {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    Executor executor_;
+    handler_memory& memory_;
+    Handler handler_;
+};
+
+template <typename Executor, typename Handler>
+recycling_handler<Executor, std::decay_t<Handler>> make_recycling_handler(const Executor& ex, handler_memory& mem, Handler&& h) {
+    return recycling_handler<Executor, std::decay_t<Handler>>(ex, mem, std::forward<Handler>(h));
+}
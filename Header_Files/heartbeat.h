@@ -0,0 +1,89 @@
+#pragma once
+#include "common.h"
+
+#include <cmath>
+
+// Liveness settings of a session. The exchange is asked to send a heartbeat every
+// exchange_interval and answers test_request frames; independently the session
+// pings every ping_interval. If nothing at all (data, pong or heartbeat) arrives
+// for liveness_timeout the link is treated as half-open and failed over. With a
+// ClockSync attached, the same timer samples public/get_time every
+// clock_sample_interval (every tick until the first few samples are in).
+struct heartbeat_config {
+    std::chrono::seconds exchange_interval{10};   // public/set_heartbeat, Deribit minimum is 10
+    std::chrono::milliseconds ping_interval{1000};
+    std::chrono::milliseconds liveness_timeout{5000};
+    std::chrono::seconds clock_sample_interval{10};
+};
+
+inline void validate_heartbeat_config(const heartbeat_config& config) {
+    if (config.ping_interval.count() <= 0) {
+        throw std::invalid_argument("'ping_interval' must be positive.");
+    }
+    if (config.liveness_timeout <= config.ping_interval) {
+        throw std::invalid_argument("'liveness_timeout' must be longer than 'ping_interval'.");
+    }
+}
+
+struct latency_summary {
+    std::uint64_t samples = 0;   // total recorded, including ones rolled out of the window
+    std::size_t window = 0;      // samples the percentiles are computed over
+    double last_us = 0;
+    double min_us = 0;
+    double median_us = 0;
+    double p99_us = 0;
+    double max_us = 0;
+};
+
+inline void print_latency_summary(std::ostream& os, const char* name, const latency_summary& s) {
+    if (s.samples == 0) {
+        os << name << ": no samples yet\n";
+        return;
+    }
+    os << name << " (us, last " << s.window << " of " << s.samples << "): last " << std::llround(s.last_us)
+       << "  min " << std::llround(s.min_us) << "  median " << std::llround(s.median_us)
+       << "  p99 " << std::llround(s.p99_us) << "  max " << std::llround(s.max_us) << "\n";
+}
+
+// Rolling window of round-trip samples for one connection. Written on the
+// session strand, read from the CLI thread.
+class latency_series {
+public:
+    explicit latency_series(std::size_t capacity = 1024)
+        : samples_(capacity)
+    {
+    }
+
+    void record(std::chrono::nanoseconds rtt) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        samples_[count_ % samples_.size()] = std::chrono::duration<double, std::micro>(rtt).count();
+        ++count_;
+    }
+
+    latency_summary summary() const {
+        std::vector<double> window;
+        latency_summary s;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            s.samples = count_;
+            if (count_ == 0) {
+                return s;
+            }
+            s.last_us = samples_[(count_ - 1) % samples_.size()];
+            std::size_t n = std::min<std::uint64_t>(count_, samples_.size());
+            window.assign(samples_.begin(), samples_.begin() + n);
+        }
+        std::sort(window.begin(), window.end());
+        s.window = window.size();
+        s.min_us = window.front();
+        s.median_us = window[window.size() / 2];
+        s.p99_us = window[std::min(window.size() - 1, window.size() * 99 / 100)];
+        s.max_us = window.back();
+        return s;
+    }
+
+private:
+    mutable std::mutex mtx_;
+    std::vector<double> samples_;
+    std::uint64_t count_ = 0;
+};
@@ -0,0 +1,366 @@
+#pragma once
+#include "common.h"
+#include "json_rpc.h"
+#include "fixed_point.h"
+#include "symbol_table.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+enum class instrument_kind : std::uint8_t { unknown, future, option, spot, future_combo, option_combo };
+
+inline instrument_kind parse_instrument_kind(const std::string& kind) {
+    if (kind == "future") return instrument_kind::future;
+    if (kind == "option") return instrument_kind::option;
+    if (kind == "spot") return instrument_kind::spot;
+    if (kind == "future_combo") return instrument_kind::future_combo;
+    if (kind == "option_combo") return instrument_kind::option_combo;
+    return instrument_kind::unknown;
+}
+
+inline const char* to_string(instrument_kind kind) {
+    switch (kind) {
+        case instrument_kind::future: return "future";
+        case instrument_kind::option: return "option";
+        case instrument_kind::spot: return "spot";
+        case instrument_kind::future_combo: return "future_combo";
+        case instrument_kind::option_combo: return "option_combo";
+        default: return "unknown";
+    }
+}
+
+struct instrument_info {
+    instrument_id id = no_symbol;
+    currency_id currency = no_symbol;
+    instrument_kind kind = instrument_kind::unknown;
+    instrument_scale scale;
+    double contract_size = 0;
+    double min_trade_amount = 0;
+    std::int64_t expiration_timestamp = 0;  // ms since epoch
+    bool active = true;
+
+    std::string_view name() const { return instrument_symbols().name(id); }
+    std::string_view currency_name() const { return currency_symbols().name(currency); }
+};
+
+// Registry of exchange instruments loaded from public/get_instruments, indexed by
+// the process-wide instrument id (see symbol_table.h). Ids of names that are not
+// listed instruments stay empty. The cache keeps instruments in id order, so
+// loading it before anything else interns names re-creates the same ids across
+// restarts. The cache is a flat, memory-mapped file so startup needs no network
+// round trip.
+class InstrumentRegistry {
+public:
+    std::optional<instrument_id> find(std::string_view name) const {
+        auto id = instrument_symbols().find(name);
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!id || !known_locked(*id)) {
+            return std::nullopt;
+        }
+        return id;
+    }
+
+    std::optional<instrument_info> get(instrument_id id) const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!known_locked(id)) {
+            return std::nullopt;
+        }
+        return instruments_[id];
+    }
+
+    std::optional<instrument_info> get(std::string_view name) const {
+        auto id = instrument_symbols().find(name);
+        return id ? get(*id) : std::nullopt;
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return count_;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    const TickTable& ticks() const { return ticks_; }
+
+    // Builds public/get_currencies; get_instruments requests for every currency follow
+    // once its response arrives. Requests are tracked so on_response can claim them.
+    jsonrpc make_refresh_request() {
+        jsonrpc j("public/get_currencies");
+        std::lock_guard<std::mutex> lock(mtx_);
+        pending_[j["id"].get<std::string>()] = std::string();
+        return j;
+    }
+
+    // Handles responses to requests created by this registry. Returns the follow-up
+    // requests to send (get_instruments per currency) through follow_up.
+    bool on_response(const json& response, std::vector<jsonrpc>& follow_up) {
+        auto id_it = response.find("id");
+        if (id_it == response.end() || !id_it->is_string()) {
+            return false;
+        }
+        std::string currency;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            auto it = pending_.find(id_it->get<std::string>());
+            if (it == pending_.end()) {
+                return false;
+            }
+            currency = std::move(it->second);
+            pending_.erase(it);
+        }
+
+        auto result_it = response.find("result");
+        if (result_it == response.end() || !result_it->is_array()) {
+            std::cerr << "Instrument refresh failed: " << response.dump() << "\n";
+            return true;
+        }
+
+        if (currency.empty()) {
+            // get_currencies response: fan out one get_instruments per currency
+            for (const auto& c : *result_it) {
+                jsonrpc j("public/get_instruments");
+                j["params"] = {{"currency", c.value("currency", "")}, {"expired", false}};
+                std::lock_guard<std::mutex> lock(mtx_);
+                pending_[j["id"].get<std::string>()] = c.value("currency", "");
+                follow_up.push_back(std::move(j));
+            }
+            return true;
+        }
+
+        merge(currency, *result_it);
+        return true;
+    }
+
+    // True while a refresh still waits for responses.
+    bool refreshing() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return !pending_.empty();
+    }
+
+    // Merges one currency's get_instruments result. New instruments are appended with
+    // fresh ids, known ones updated in place, and ones no longer listed are deactivated.
+    void merge(const std::string& currency, const json& instruments) {
+        const currency_id currency_key = currency_symbols().intern(currency);
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::unordered_set<instrument_id> seen;
+        std::size_t added = 0, updated = 0, deactivated = 0;
+
+        for (const auto& item : instruments) {
+            auto name_it = item.find("instrument_name");
+            if (name_it == item.end() || !name_it->is_string() || name_it->get_ref<const std::string&>().empty()) {
+                continue;
+            }
+            instrument_info info;
+            info.id = instrument_symbols().intern(name_it->get_ref<const std::string&>());
+            info.currency = currency_key;
+            info.kind = parse_instrument_kind(item.value("kind", ""));
+            info.contract_size = item.value("contract_size", 0.0);
+            info.min_trade_amount = item.value("min_trade_amount", 0.0);
+            info.expiration_timestamp = item.value("expiration_timestamp", std::int64_t(0));
+            info.active = item.value("is_active", true);
+            if (!make_decimal_step(item.value("tick_size", 0.0), info.scale.tick) ||
+                !make_decimal_step(info.min_trade_amount, info.scale.lot)) {
+                info.scale = TickTable::default_scale(info.name());
+            }
+
+            if (known_locked(info.id)) {
+                ++updated;
+            } else {
+                ++added;
+            }
+            store_locked(info);
+            seen.insert(info.id);
+        }
+
+        for (auto& slot : instruments_) {
+            if (slot && slot->currency == currency_key && slot->active && !seen.count(slot->id)) {
+                slot->active = false;
+                ++deactivated;
+            }
+        }
+        std::cout << "Instruments " << currency << ": " << added << " added, " << updated << " updated, "
+                  << deactivated << " deactivated.\n";
+    }
+
+    // Writes the registry to path atomically (temp file + rename) through a shared mapping.
+    bool save(const std::string& path) const {
+        std::lock_guard<std::mutex> lock(mtx_);
+
+        std::size_t names_size = 0;
+        for (const auto& slot : instruments_) {
+            if (slot) {
+                names_size += slot->name().size();
+            }
+        }
+        std::size_t records_offset = sizeof(cache_header);
+        std::size_t names_offset = records_offset + count_ * sizeof(cache_record);
+        std::size_t file_size = names_offset + names_size;
+
+        std::string tmp_path = path + ".tmp";
+        int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        if (::ftruncate(fd, static_cast<off_t>(file_size)) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void* base = ::mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+
+        char* bytes = static_cast<char*>(base);
+        cache_header header{};
+        std::memcpy(header.magic, cache_magic, sizeof(header.magic));
+        header.version = cache_version;
+        header.count = static_cast<std::uint32_t>(count_);
+        header.names_offset = names_offset;
+        header.names_size = names_size;
+        std::memcpy(bytes, &header, sizeof(header));
+
+        std::size_t name_pos = 0;
+        std::size_t i = 0;
+        for (const auto& slot : instruments_) {
+            if (!slot) {
+                continue;
+            }
+            const instrument_info& info = *slot;
+            const std::string_view name = info.name();
+            const std::string_view currency = info.currency_name();
+            cache_record r{};
+            r.name_offset = static_cast<std::uint32_t>(name_pos);
+            r.name_len = static_cast<std::uint16_t>(name.size());
+            r.kind = static_cast<std::uint8_t>(info.kind);
+            r.active = info.active;
+            r.tick_mantissa = info.scale.tick.mantissa;
+            r.tick_exponent = info.scale.tick.exponent;
+            r.lot_mantissa = info.scale.lot.mantissa;
+            r.lot_exponent = info.scale.lot.exponent;
+            r.contract_size = info.contract_size;
+            r.min_trade_amount = info.min_trade_amount;
+            r.expiration_timestamp = info.expiration_timestamp;
+            std::memcpy(r.currency, currency.data(), std::min(currency.size(), sizeof(r.currency) - 1));
+            std::memcpy(bytes + records_offset + i * sizeof(cache_record), &r, sizeof(r));
+            std::memcpy(bytes + names_offset + name_pos, name.data(), name.size());
+            name_pos += name.size();
+            ++i;
+        }
+
+        bool ok = ::msync(base, file_size, MS_SYNC) == 0;
+        ::munmap(base, file_size);
+        return ok && std::rename(tmp_path.c_str(), path.c_str()) == 0;
+    }
+
+    // Loads a cache written by save(). Returns false when the file is missing or invalid.
+    bool load(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(cache_header)) {
+            ::close(fd);
+            return false;
+        }
+        std::size_t file_size = static_cast<std::size_t>(st.st_size);
+        void* base = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+
+        const char* bytes = static_cast<const char*>(base);
+        cache_header header;
+        std::memcpy(&header, bytes, sizeof(header));
+        std::size_t records_end = sizeof(cache_header) + std::size_t(header.count) * sizeof(cache_record);
+        if (std::memcmp(header.magic, cache_magic, sizeof(header.magic)) != 0 || header.version != cache_version ||
+            records_end > file_size || header.names_offset != records_end ||
+            header.names_offset + header.names_size > file_size) {
+            ::munmap(base, file_size);
+            return false;
+        }
+
+        std::vector<instrument_info> loaded(header.count);
+        for (std::uint32_t i = 0; i < header.count; ++i) {
+            cache_record r;
+            std::memcpy(&r, bytes + sizeof(cache_header) + i * sizeof(cache_record), sizeof(r));
+            if (std::size_t(r.name_offset) + r.name_len > header.names_size) {
+                ::munmap(base, file_size);
+                return false;
+            }
+            instrument_info& info = loaded[i];
+            info.id = instrument_symbols().intern(
+                std::string_view(bytes + header.names_offset + r.name_offset, r.name_len));
+            info.currency = currency_symbols().intern(std::string_view(r.currency, strnlen(r.currency, sizeof(r.currency))));
+            info.kind = static_cast<instrument_kind>(r.kind);
+            info.active = r.active != 0;
+            info.scale.tick = {r.tick_mantissa, r.tick_exponent};
+            info.scale.lot = {r.lot_mantissa, r.lot_exponent};
+            info.contract_size = r.contract_size;
+            info.min_trade_amount = r.min_trade_amount;
+            info.expiration_timestamp = r.expiration_timestamp;
+        }
+        ::munmap(base, file_size);
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        instruments_.clear();
+        count_ = 0;
+        for (const auto& info : loaded) {
+            store_locked(info);
+        }
+        return true;
+    }
+
+private:
+    bool known_locked(instrument_id id) const {
+        return id < instruments_.size() && instruments_[id].has_value();
+    }
+
+    void store_locked(const instrument_info& info) {
+        if (info.id >= instruments_.size()) {
+            instruments_.resize(info.id + 1);
+        }
+        if (!instruments_[info.id]) {
+            ++count_;
+        }
+        instruments_[info.id] = info;
+        ticks_.set(info.id, info.scale);
+    }
+
+    static constexpr char cache_magic[8] = {'D', 'R', 'B', 'I', 'N', 'S', 'T', '\0'};
+    static constexpr std::uint32_t cache_version = 1;
+
+    struct cache_header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t count;
+        std::uint64_t names_offset;
+        std::uint64_t names_size;
+    };
+
+    struct cache_record {
+        std::int64_t tick_mantissa;
+        std::int64_t lot_mantissa;
+        double contract_size;
+        double min_trade_amount;
+        std::int64_t expiration_timestamp;
+        std::uint32_t name_offset;
+        std::uint16_t name_len;
+        std::uint8_t kind;
+        std::uint8_t active;
+        std::uint8_t tick_exponent;
+        std::uint8_t lot_exponent;
+        char currency[14];
+    };
+
+    mutable std::mutex mtx_;
+    std::vector<std::optional<instrument_info>> instruments_;    // indexed by instrument_id
+    std::size_t count_ = 0;
+    std::unordered_map<std::string, std::string> pending_;       // request id -> currency ("" for get_currencies)
+    TickTable ticks_;
+};
@@ -0,0 +1,538 @@
+#pragma once
+#include "common.h"
+#include "json_rpc.h"
+#include "fixed_point.h"
+
+#include <bit>
+#include <charconv>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OEMS_HAVE_AVX2_INDEX 1
+#endif
+
+// Two-stage JSON decoding in the style of simdjson's on-demand API.
+//
+// Stage 1 (json_document::parse) classifies the frame 64 bytes at a time (two
+// AVX2 compares per character class where the CPU has them) and records the
+// offset of every structural character ({ } [ ] : ,), every opening quote and
+// every start of a number or literal outside strings. Escapes and string
+// interiors are resolved with bit arithmetic, without branching per byte.
+//
+// Stage 2 (json_element) walks that index only where asked: find("method")
+// looks at the keys of one object and skips nested values by counting brackets
+// in the index; strings and numbers are decoded when read, numbers with the
+// SIMD parse_double/parse_decimal. Nothing is allocated until a string is
+// unescaped or to_json() builds an nlohmann DOM for code that needs one.
+//
+// Like simdjson on-demand, only what is read is validated: malformed structure
+// met while walking throws json_index_error, unread subtrees are not checked.
+
+class json_index_error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+namespace json_stage1 {
+
+struct block_masks {
+    std::uint64_t backslash = 0;
+    std::uint64_t quote = 0;
+    std::uint64_t whitespace = 0;
+    std::uint64_t op = 0;        // { } [ ] : ,
+};
+
+inline block_masks classify_scalar(const char* p) {
+    block_masks m;
+    for (unsigned i = 0; i < 64; ++i) {
+        const std::uint64_t bit = std::uint64_t(1) << i;
+        switch (p[i]) {
+            case '\\': m.backslash |= bit; break;
+            case '"': m.quote |= bit; break;
+            case ' ': case '\t': case '\n': case '\r': m.whitespace |= bit; break;
+            case '{': case '}': case '[': case ']': case ':': case ',': m.op |= bit; break;
+            default: break;
+        }
+    }
+    return m;
+}
+
+#ifdef OEMS_HAVE_AVX2_INDEX
+__attribute__((target("avx2")))
+inline std::uint64_t eq_mask(__m256i lo, __m256i hi, char c) {
+    const __m256i v = _mm256_set1_epi8(c);
+    return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, v))) |
+           static_cast<std::uint64_t>(static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, v)))) << 32;
+}
+
+__attribute__((target("avx2")))
+inline block_masks classify_avx2(const char* p) {
+    const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+    // setting bit 5 folds '[' onto '{' and ']' onto '}'
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i lo_folded = _mm256_or_si256(lo, case_bit);
+    const __m256i hi_folded = _mm256_or_si256(hi, case_bit);
+    block_masks m;
+    m.backslash = eq_mask(lo, hi, '\\');
+    m.quote = eq_mask(lo, hi, '"');
+    m.whitespace = eq_mask(lo, hi, ' ') | eq_mask(lo, hi, '\t') | eq_mask(lo, hi, '\n') | eq_mask(lo, hi, '\r');
+    m.op = eq_mask(lo_folded, hi_folded, '{') | eq_mask(lo_folded, hi_folded, '}') |
+           eq_mask(lo, hi, ':') | eq_mask(lo, hi, ',');
+    return m;
+}
+
+inline const bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+inline block_masks classify(const char* p) {
+#ifdef OEMS_HAVE_AVX2_INDEX
+    if (has_avx2) {
+        return classify_avx2(p);
+    }
+#endif
+    return classify_scalar(p);
+}
+
+// Carries between blocks: an escape pending on the first byte, whether the block
+// starts inside a string (all ones) and whether it starts inside a scalar.
+struct carry {
+    std::uint64_t escaped = 0;
+    std::uint64_t in_string = 0;
+    std::uint64_t scalar = 0;
+};
+
+// Bit i set when an odd number of quotes are at or before i.
+inline std::uint64_t prefix_xor(std::uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// Characters preceded by an odd run of backslashes (simdjson's branchless form).
+inline std::uint64_t find_escaped(std::uint64_t backslash, std::uint64_t& prev_escaped) {
+    backslash &= ~prev_escaped;
+    const std::uint64_t follows_escape = backslash << 1 | prev_escaped;
+    const std::uint64_t even_bits = 0x5555555555555555ull;
+    const std::uint64_t odd_sequence_starts = backslash & ~even_bits & ~follows_escape;
+    std::uint64_t sequences_starting_on_even_bits;
+    prev_escaped = __builtin_add_overflow(odd_sequence_starts, backslash, &sequences_starting_on_even_bits);
+    const std::uint64_t invert_mask = sequences_starting_on_even_bits << 1;
+    return (even_bits ^ invert_mask) & follows_escape;
+}
+
+inline std::uint64_t index_bits(const block_masks& m, carry& c) {
+    const std::uint64_t quote = m.quote & ~find_escaped(m.backslash, c.escaped);
+    // includes the opening quote, excludes the closing one
+    const std::uint64_t in_string = prefix_xor(quote) ^ c.in_string;
+    c.in_string = static_cast<std::uint64_t>(static_cast<std::int64_t>(in_string) >> 63);
+    const std::uint64_t scalar = ~(m.op | m.whitespace | quote | in_string);
+    const std::uint64_t scalar_start = scalar & ~(scalar << 1 | c.scalar);
+    c.scalar = scalar >> 63;
+    return (m.op & ~in_string) | (quote & in_string) | scalar_start;
+}
+
+} // namespace json_stage1
+
+class json_document;
+
+enum class json_kind { object, array, string, number, boolean, null };
+
+// A value of an indexed document, i.e. a position in its structural index.
+// Cheap to copy; valid while the document and the text it indexed are.
+class json_element {
+public:
+    json_element(const json_document& doc, std::uint32_t token)
+        : doc_(&doc)
+        , token_(token)
+    {
+    }
+
+    json_kind kind() const;
+    bool is_object() const { return kind() == json_kind::object; }
+    bool is_array() const { return kind() == json_kind::array; }
+    bool is_string() const { return kind() == json_kind::string; }
+    bool is_number() const { return kind() == json_kind::number; }
+
+    // Member of an object by key; nullopt when absent or not an object. Keys are
+    // compared as they appear in the text, escapes included.
+    std::optional<json_element> find(std::string_view key) const;
+
+    // f(raw key, value) for every member of an object.
+    template<class F>
+    void for_each_member(F&& f) const;
+
+    // f(value) for every element of an array.
+    template<class F>
+    void for_each_element(F&& f) const;
+
+    // Characters between the quotes, escapes left as they are.
+    std::string_view raw_string() const;
+    // Unescaped string value.
+    std::string get_string() const;
+    // Number or literal text.
+    std::string_view raw_scalar() const;
+
+    std::int64_t get_int64() const;
+    double get_double() const;
+    // Number scaled by 10^exponent, as parse_decimal.
+    std::int64_t get_decimal(std::uint8_t exponent) const;
+    bool get_bool() const;
+
+    json to_json() const;
+
+private:
+    [[noreturn]] static void fail(const char* what) { throw json_index_error(what); }
+
+    const json_document* doc_;
+    std::uint32_t token_;
+};
+
+class json_document {
+public:
+    // Stage 1. The text must outlive the document's elements; the index buffer
+    // is reused across calls.
+    void parse(std::string_view text) {
+        text_ = text;
+        index_.clear();
+        index_.reserve(text.size() / 4 + 16);
+        json_stage1::carry c;
+        std::size_t i = 0;
+        for (; i + 64 <= text.size(); i += 64) {
+            emit(json_stage1::index_bits(json_stage1::classify(text.data() + i), c), i);
+        }
+        if (i < text.size()) {
+            char tail[64];
+            std::memset(tail, ' ', sizeof(tail));
+            std::memcpy(tail, text.data() + i, text.size() - i);
+            emit(json_stage1::index_bits(json_stage1::classify(tail), c), i);
+        }
+        if (c.in_string) {
+            throw json_index_error("unterminated string");
+        }
+        if (index_.empty()) {
+            throw json_index_error("empty document");
+        }
+    }
+
+    json_element root() const { return json_element(*this, 0); }
+
+    // The whole document as an nlohmann DOM; throws on trailing content.
+    json to_json() const {
+        json j = root().to_json();
+        if (skip(0) != index_.size()) {
+            throw json_index_error("trailing content after the document");
+        }
+        return j;
+    }
+
+    std::string_view text() const { return text_; }
+    const std::vector<std::uint32_t>& index() const { return index_; }
+
+private:
+    friend class json_element;
+
+    void emit(std::uint64_t bits, std::size_t base) {
+        for (; bits; bits &= bits - 1) {
+            index_.push_back(static_cast<std::uint32_t>(base + std::countr_zero(bits)));
+        }
+    }
+
+    char at(std::uint32_t token) const {
+        return token < index_.size() ? text_[index_[token]] : '\0';
+    }
+
+    // Token after the value starting at token.
+    std::uint32_t skip(std::uint32_t token) const {
+        const char c = at(token);
+        if (c != '{' && c != '[') {
+            return token + 1;
+        }
+        std::size_t depth = 0;
+        for (std::uint32_t t = token; t < index_.size(); ++t) {
+            const char d = text_[index_[t]];
+            if (d == '{' || d == '[') {
+                ++depth;
+            } else if ((d == '}' || d == ']') && --depth == 0) {
+                return t + 1;
+            }
+        }
+        throw json_index_error("unterminated container");
+    }
+
+    // End of a string or scalar: the next token, less the whitespace before it.
+    std::size_t value_end(std::uint32_t token) const {
+        std::size_t end = token + 1 < index_.size() ? index_[token + 1] : text_.size();
+        while (end > index_[token] && (text_[end - 1] == ' ' || text_[end - 1] == '\t' ||
+                                       text_[end - 1] == '\n' || text_[end - 1] == '\r')) {
+            --end;
+        }
+        return end;
+    }
+
+    std::string_view text_;
+    std::vector<std::uint32_t> index_;
+};
+
+inline json_kind json_element::kind() const {
+    switch (doc_->at(token_)) {
+        case '{': return json_kind::object;
+        case '[': return json_kind::array;
+        case '"': return json_kind::string;
+        case 't': case 'f': return json_kind::boolean;
+        case 'n': return json_kind::null;
+        case '-': case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            return json_kind::number;
+        default: fail("unexpected character");
+    }
+}
+
+template<class F>
+void json_element::for_each_member(F&& f) const {
+    if (doc_->at(token_) != '{') {
+        fail("not an object");
+    }
+    std::uint32_t t = token_ + 1;
+    if (doc_->at(t) == '}') {
+        return;
+    }
+    for (;;) {
+        if (doc_->at(t) != '"' || doc_->at(t + 1) != ':') {
+            fail("expected \"key\": in object");
+        }
+        f(json_element(*doc_, t).raw_string(), json_element(*doc_, t + 2));
+        t = doc_->skip(t + 2);
+        const char c = doc_->at(t);
+        if (c == '}') {
+            return;
+        }
+        if (c != ',') {
+            fail("expected , or } in object");
+        }
+        ++t;
+    }
+}
+
+template<class F>
+void json_element::for_each_element(F&& f) const {
+    if (doc_->at(token_) != '[') {
+        fail("not an array");
+    }
+    std::uint32_t t = token_ + 1;
+    if (doc_->at(t) == ']') {
+        return;
+    }
+    for (;;) {
+        f(json_element(*doc_, t));
+        t = doc_->skip(t);
+        const char c = doc_->at(t);
+        if (c == ']') {
+            return;
+        }
+        if (c != ',') {
+            fail("expected , or ] in array");
+        }
+        ++t;
+    }
+}
+
+inline std::optional<json_element> json_element::find(std::string_view key) const {
+    if (doc_->at(token_) != '{') {
+        return std::nullopt;
+    }
+    std::uint32_t t = token_ + 1;
+    if (doc_->at(t) == '}') {
+        return std::nullopt;
+    }
+    for (;;) {
+        if (doc_->at(t) != '"' || doc_->at(t + 1) != ':') {
+            fail("expected \"key\": in object");
+        }
+        if (json_element(*doc_, t).raw_string() == key) {
+            return json_element(*doc_, t + 2);
+        }
+        t = doc_->skip(t + 2);
+        const char c = doc_->at(t);
+        if (c == '}') {
+            return std::nullopt;
+        }
+        if (c != ',') {
+            fail("expected , or } in object");
+        }
+        ++t;
+    }
+}
+
+inline std::string_view json_element::raw_string() const {
+    if (doc_->at(token_) != '"') {
+        fail("not a string");
+    }
+    const std::size_t begin = doc_->index_[token_] + 1;
+    const std::size_t end = doc_->value_end(token_);
+    if (end <= begin || doc_->text_[end - 1] != '"') {
+        fail("malformed string");
+    }
+    return doc_->text_.substr(begin, end - 1 - begin);
+}
+
+inline std::string json_element::get_string() const {
+    const std::string_view raw = raw_string();
+    std::string out;
+    out.reserve(raw.size());
+    auto hex4 = [&](std::size_t i) {
+        unsigned v = 0;
+        if (i + 4 > raw.size() || std::from_chars(raw.data() + i, raw.data() + i + 4, v, 16).ptr != raw.data() + i + 4) {
+            fail("bad \\u escape");
+        }
+        return v;
+    };
+    for (std::size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] != '\\') {
+            out += raw[i];
+            continue;
+        }
+        if (++i == raw.size()) {
+            fail("bad escape");
+        }
+        switch (raw[i]) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                unsigned cp = hex4(i + 1);
+                i += 4;
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    if (i + 2 >= raw.size() || raw[i + 1] != '\\' || raw[i + 2] != 'u') {
+                        fail("unpaired surrogate");
+                    }
+                    const unsigned low = hex4(i + 3);
+                    if (low < 0xDC00 || low >= 0xE000) {
+                        fail("unpaired surrogate");
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                } else if (cp >= 0xDC00 && cp < 0xE000) {
+                    fail("unpaired surrogate");
+                }
+                if (cp < 0x80) {
+                    out += static_cast<char>(cp);
+                } else if (cp < 0x800) {
+                    out += static_cast<char>(0xC0 | (cp >> 6));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    out += static_cast<char>(0xE0 | (cp >> 12));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                } else {
+                    out += static_cast<char>(0xF0 | (cp >> 18));
+                    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default: fail("bad escape");
+        }
+    }
+    return out;
+}
+
+inline std::string_view json_element::raw_scalar() const {
+    const std::size_t begin = doc_->index_.at(token_);
+    return doc_->text_.substr(begin, doc_->value_end(token_) - begin);
+}
+
+inline std::int64_t json_element::get_int64() const {
+    const std::string_view s = raw_scalar();
+    std::int64_t v;
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (ec != std::errc() || end != s.data() + s.size()) {
+        fail("not an integer");
+    }
+    return v;
+}
+
+inline double json_element::get_double() const {
+    double v;
+    if (!is_number() || !parse_double(raw_scalar(), v)) {
+        fail("not a number");
+    }
+    return v;
+}
+
+inline std::int64_t json_element::get_decimal(std::uint8_t exponent) const {
+    std::int64_t v;
+    if (!is_number() || !parse_decimal(raw_scalar(), exponent, v)) {
+        fail("not a decimal at this exponent");
+    }
+    return v;
+}
+
+inline bool json_element::get_bool() const {
+    const std::string_view s = raw_scalar();
+    if (s == "true") return true;
+    if (s == "false") return false;
+    fail("not a boolean");
+}
+
+// Numbers keep nlohmann's types: unsigned or signed integers when they fit,
+// otherwise double.
+inline json json_element::to_json() const {
+    switch (kind()) {
+        case json_kind::object: {
+            json out = json::object();
+            for_each_member([&](std::string_view, json_element value) {
+                // keys are re-read unescaped; a repeated key keeps its last value, as in nlohmann
+                out[json_element(*doc_, value.token_ - 2).get_string()] = value.to_json();
+            });
+            return out;
+        }
+        case json_kind::array: {
+            json out = json::array();
+            for_each_element([&](json_element value) {
+                out.push_back(value.to_json());
+            });
+            return out;
+        }
+        case json_kind::string:
+            return get_string();
+        case json_kind::boolean:
+            return get_bool();
+        case json_kind::null:
+            if (raw_scalar() != "null") {
+                fail("bad literal");
+            }
+            return nullptr;
+        case json_kind::number: {
+            const std::string_view s = raw_scalar();
+            if (s.find_first_of(".eE") == std::string_view::npos) {
+                if (s[0] == '-') {
+                    std::int64_t v;
+                    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+                    if (ec == std::errc() && end == s.data() + s.size()) {
+                        return v;
+                    }
+                } else {
+                    std::uint64_t v;
+                    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+                    if (ec == std::errc() && end == s.data() + s.size()) {
+                        return v;
+                    }
+                }
+            }
+            return get_double();
+        }
+    }
+    return nullptr;
+}
@@ -26,4 +26,16 @@ public:
         (*this)["method"] = method;
         (*this)["id"] = generate_uuid();
     }
-};
\ No newline at end of file
+};
+
+// Deribit error code of a request over the account's rate limit.
+constexpr int too_many_requests = 10028;
+
+inline bool has_error_code(const json& response, int code) {
+    auto error_it = response.find("error");
+    if (error_it == response.end() || !error_it->is_object()) {
+        return false;
+    }
+    auto code_it = error_it->find("code");
+    return code_it != error_it->end() && code_it->is_number_integer() && code_it->get<int>() == code;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include "common.h"
+#include "json_rpc.h"
+#include "clock_sync.h"
+
+#include <string_view>
+
+// Exchange send time of a message in microseconds: usOut on responses,
+// data.timestamp (ms) on notifications; for array data the newest entry is last.
+inline std::optional<std::int64_t> exchange_send_us(const json& j) {
+    auto us_out = j.find("usOut");
+    if (us_out != j.end() && us_out->is_number()) {
+        return us_out->get<std::int64_t>();
+    }
+    auto params_it = j.find("params");
+    if (params_it == j.end() || !params_it->contains("data")) {
+        return std::nullopt;
+    }
+    const json& data = (*params_it)["data"];
+    const json& latest = data.is_array() && !data.empty() ? data.back() : data;
+    auto ts = latest.is_object() ? latest.find("timestamp") : latest.end();
+    if (ts == latest.end() || !ts->is_number()) {
+        return std::nullopt;
+    }
+    return ts->get<std::int64_t>() * 1000;
+}
+
+// Element of the inbox and feed queues: a decoded message, or the raw text of a
+// frame that the dispatcher routed without parsing (decode_mode::lazy). A raw
+// frame is parsed by the first get() on the consumer thread, which also stamps
+// "one_way_delay_us" from the receive time taken on the read strand. get() then
+// throws json::parse_error for a malformed frame. Not thread-safe: a popped
+// message belongs to one consumer.
+class lazy_json {
+public:
+    lazy_json() = default;
+
+    lazy_json(json decoded)
+        : json_(std::move(decoded))
+    {
+    }
+
+    lazy_json(std::string_view frame, std::int64_t received_ns, std::shared_ptr<const ClockSync> clock)
+        : decoded_(false)
+        , raw_(frame)
+        , received_ns_(received_ns)
+        , clock_(std::move(clock))
+    {
+    }
+
+    bool decoded() const { return decoded_; }
+
+    // Frame text; empty once decoded or for messages queued decoded.
+    std::string_view raw() const { return raw_; }
+
+    json& get() {
+        if (!decoded_) {
+            decode();
+        }
+        return json_;
+    }
+
+private:
+    void decode() {
+        json_ = json::parse(raw_);
+        decoded_ = true;
+        raw_.clear();
+        raw_.shrink_to_fit();
+        if (clock_ && received_ns_ != 0 && clock_->synced()) {
+            if (auto sent_us = exchange_send_us(json_)) {
+                json_["one_way_delay_us"] = clock_->to_exchange_us(received_ns_) - *sent_us;
+            }
+        }
+    }
+
+    json json_;
+    bool decoded_ = true;
+    std::string raw_;
+    std::int64_t received_ns_ = 0;
+    std::shared_ptr<const ClockSync> clock_;
+};
@@ -0,0 +1,185 @@
+#pragma once
+#include "common.h"
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <sstream>
+
+// Prometheus metrics of the process. Every series is a relaxed atomic written by
+// its owner (the session strand, the queues) and read by render(), so a scrape
+// never takes a lock the strand also takes and never waits on it. The registry's
+// own mutex only guards which series exist; it is taken when a connection or a
+// sampled series is added and by render(), never on a hot path.
+namespace metrics {
+
+class counter {
+public:
+    void inc(std::uint64_t n = 1) noexcept { value_.fetch_add(n, std::memory_order_relaxed); }
+    std::uint64_t value() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::uint64_t> value_{0};
+};
+
+// Latency histogram over fixed buckets from 5 us to 1 s.
+class histogram {
+public:
+    struct bucket_bound {
+        std::uint64_t ns;
+        const char* le;   // upper bound in seconds, as exposed
+    };
+
+    static constexpr std::array<bucket_bound, 17> bounds = {{
+        {5000, "5e-06"}, {10000, "1e-05"}, {25000, "2.5e-05"}, {50000, "5e-05"},
+        {100000, "0.0001"}, {250000, "0.00025"}, {500000, "0.0005"},
+        {1000000, "0.001"}, {2500000, "0.0025"}, {5000000, "0.005"},
+        {10000000, "0.01"}, {25000000, "0.025"}, {50000000, "0.05"},
+        {100000000, "0.1"}, {250000000, "0.25"}, {500000000, "0.5"}, {1000000000, "1"},
+    }};
+
+    void observe(std::chrono::nanoseconds d) noexcept {
+        std::uint64_t ns = d.count() > 0 ? static_cast<std::uint64_t>(d.count()) : 0;
+        std::size_t i = 0;
+        while (i < bounds.size() && ns > bounds[i].ns) {
+            ++i;
+        }
+        buckets_[i].fetch_add(1, std::memory_order_relaxed);
+        sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    struct snapshot {
+        std::array<std::uint64_t, bounds.size() + 1> cumulative{};   // last is +Inf, the count
+        double sum_seconds = 0;
+    };
+
+    // Buckets are read one by one, so a snapshot taken during observe() may be off
+    // by that one sample; the count is derived from the buckets so they agree.
+    snapshot read() const noexcept {
+        snapshot s;
+        std::uint64_t total = 0;
+        for (std::size_t i = 0; i < buckets_.size(); ++i) {
+            total += buckets_[i].load(std::memory_order_relaxed);
+            s.cumulative[i] = total;
+        }
+        s.sum_seconds = static_cast<double>(sum_ns_.load(std::memory_order_relaxed)) * 1e-9;
+        return s;
+    }
+
+private:
+    std::array<std::atomic<std::uint64_t>, bounds.size() + 1> buckets_{};
+    std::atomic<std::uint64_t> sum_ns_{0};
+};
+
+// Written by one session, on its strand.
+struct connection_metrics {
+    counter messages_in;
+    counter messages_out;
+    counter bytes_in;
+    counter bytes_out;
+    counter rate_limited;   // too_many_requests errors from the exchange
+    histogram parse_latency;
+    histogram ping_rtt;
+};
+
+enum class kind { counter, gauge };
+
+class registry {
+public:
+    // A series read by calling read at scrape time; read must not block.
+    void add_sampled(std::string name, std::string help, kind type, std::string labels,
+                     std::function<double()> read) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        sampled_.push_back({std::move(name), std::move(help), type, std::move(labels), std::move(read)});
+    }
+
+    // Exposes a session's metrics under connection="<id>" until the session is gone.
+    void add_connection(std::uint32_t id, std::shared_ptr<const connection_metrics> m) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        connections_.push_back({id, std::move(m)});
+    }
+
+    // Text exposition format 0.0.4.
+    std::string render() {
+        std::ostringstream os;
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (std::size_t i = 0; i < sampled_.size(); ++i) {
+            const sampled& s = sampled_[i];
+            // consecutive entries with the same name form one family
+            if (i == 0 || sampled_[i - 1].name != s.name) {
+                header(os, s.name, s.help, s.type == kind::counter ? "counter" : "gauge");
+            }
+            os << s.name;
+            if (!s.labels.empty()) {
+                os << '{' << s.labels << '}';
+            }
+            os << ' ' << format(s.read()) << '\n';
+        }
+
+        connection_counter(os, "oems_messages_received_total", "WebSocket frames received.", &connection_metrics::messages_in);
+        connection_counter(os, "oems_messages_sent_total", "WebSocket frames written.", &connection_metrics::messages_out);
+        connection_counter(os, "oems_received_bytes_total", "WebSocket payload bytes received.", &connection_metrics::bytes_in);
+        connection_counter(os, "oems_sent_bytes_total", "WebSocket payload bytes written.", &connection_metrics::bytes_out);
+        connection_counter(os, "oems_rate_limited_total", "Requests refused by the exchange as too_many_requests.",
+                           &connection_metrics::rate_limited);
+        connection_histogram(os, "oems_parse_latency_seconds", "Frame decode and routing time.",
+                             &connection_metrics::parse_latency);
+        connection_histogram(os, "oems_ping_rtt_seconds", "WebSocket ping to pong round trip.",
+                             &connection_metrics::ping_rtt);
+
+        // a closed connection is exposed one last time, then dropped
+        std::erase_if(connections_, [](const connection& c) { return c.metrics.use_count() == 1; });
+        return os.str();
+    }
+
+private:
+    struct sampled {
+        std::string name;
+        std::string help;
+        kind type;
+        std::string labels;   // e.g. queue="inbox"
+        std::function<double()> read;
+    };
+
+    struct connection {
+        std::uint32_t id;
+        std::shared_ptr<const connection_metrics> metrics;
+    };
+
+    static void header(std::ostream& os, std::string_view name, std::string_view help, const char* type) {
+        os << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+    }
+
+    static std::string format(double v) {
+        char buf[32];
+        auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), v);
+        return ec == std::errc() ? std::string(buf, end) : std::string("NaN");
+    }
+
+    void connection_counter(std::ostream& os, const char* name, const char* help, counter connection_metrics::*field) const {
+        header(os, name, help, "counter");
+        for (const auto& c : connections_) {
+            os << name << "{connection=\"" << c.id << "\"} " << ((*c.metrics).*field).value() << '\n';
+        }
+    }
+
+    void connection_histogram(std::ostream& os, const char* name, const char* help, histogram connection_metrics::*field) const {
+        header(os, name, help, "histogram");
+        for (const auto& c : connections_) {
+            histogram::snapshot s = ((*c.metrics).*field).read();
+            for (std::size_t i = 0; i < histogram::bounds.size(); ++i) {
+                os << name << "_bucket{connection=\"" << c.id << "\",le=\"" << histogram::bounds[i].le << "\"} "
+                   << s.cumulative[i] << '\n';
+            }
+            os << name << "_bucket{connection=\"" << c.id << "\",le=\"+Inf\"} " << s.cumulative.back() << '\n'
+               << name << "_sum{connection=\"" << c.id << "\"} " << format(s.sum_seconds) << '\n'
+               << name << "_count{connection=\"" << c.id << "\"} " << s.cumulative.back() << '\n';
+        }
+    }
+
+    std::mutex mtx_;
+    std::vector<sampled> sampled_;
+    std::vector<connection> connections_;
+};
+
+} // namespace metrics
@@ -0,0 +1,136 @@
+#pragma once
+#include "common.h"
+#include "metrics.h"
+
+#include <boost/beast/http.hpp>
+
+// Serves GET /metrics from a metrics::registry over plain HTTP on a loopback port.
+// Accepts and connections run on the io_context given to the constructor, i.e. the
+// same threads as the websocket sessions; a scrape only reads atomics, so it never
+// holds up a session strand.
+class metrics_server : public std::enable_shared_from_this<metrics_server> {
+public:
+    metrics_server(net::io_context& ioc, metrics::registry& registry)
+        : ioc_(ioc)
+        , acceptor_(net::make_strand(ioc))
+        , registry_(registry)
+    {
+    }
+
+    // Listens on 127.0.0.1:port (0 picks a free port). Throws on bind errors.
+    void start(unsigned short port) {
+        tcp::endpoint endpoint(net::ip::make_address("127.0.0.1"), port);
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(net::socket_base::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen(net::socket_base::max_listen_connections);
+        do_accept();
+    }
+
+    void stop() {
+        net::post(acceptor_.get_executor(), [self = shared_from_this()] {
+            beast::error_code ignored;
+            self->acceptor_.close(ignored);
+        });
+    }
+
+    unsigned short port() const {
+        return acceptor_.local_endpoint().port();
+    }
+
+private:
+    class connection : public std::enable_shared_from_this<connection> {
+    public:
+        connection(tcp::socket&& socket, metrics::registry& registry)
+            : stream_(std::move(socket))
+            , registry_(registry)
+        {
+        }
+
+        void run() {
+            do_read();
+        }
+
+    private:
+        void do_read() {
+            request_ = {};
+            stream_.expires_after(std::chrono::seconds(30));
+            http::async_read(stream_, buffer_, request_,
+                beast::bind_front_handler(&connection::on_read, shared_from_this()));
+        }
+
+        void on_read(beast::error_code ec, std::size_t) {
+            if (ec) {
+                // end_of_stream: the scraper closed an idle keep-alive connection
+                beast::error_code ignored;
+                stream_.socket().shutdown(tcp::socket::shutdown_send, ignored);
+                return;
+            }
+
+            response_ = {};
+            response_.version(request_.version());
+            response_.keep_alive(request_.keep_alive());
+            response_.set(http::field::server, "deribit-oems");
+            if (request_.method() != http::verb::get && request_.method() != http::verb::head) {
+                response_.result(http::status::method_not_allowed);
+                response_.set(http::field::allow, "GET, HEAD");
+            } else if (request_.target() != "/metrics") {
+                response_.result(http::status::not_found);
+                response_.set(http::field::content_type, "text/plain");
+                response_.body() = "Only /metrics is served.\n";
+            } else {
+                response_.result(http::status::ok);
+                response_.set(http::field::content_type, "text/plain; version=0.0.4");
+                response_.body() = registry_.render();
+            }
+            response_.prepare_payload();
+            if (request_.method() == http::verb::head) {
+                response_.body().clear();
+            }
+
+            http::async_write(stream_, response_,
+                beast::bind_front_handler(&connection::on_write, shared_from_this()));
+        }
+
+        void on_write(beast::error_code ec, std::size_t) {
+            if (ec) {
+                return;
+            }
+            if (!response_.keep_alive()) {
+                beast::error_code ignored;
+                stream_.socket().shutdown(tcp::socket::shutdown_send, ignored);
+                return;
+            }
+            do_read();
+        }
+
+        beast::tcp_stream stream_;
+        beast::flat_buffer buffer_;
+        http::request<http::empty_body> request_;
+        http::response<http::string_body> response_;
+        metrics::registry& registry_;
+    };
+
+    void do_accept() {
+        acceptor_.async_accept(net::make_strand(ioc_),
+            beast::bind_front_handler(&metrics_server::on_accept, shared_from_this()));
+    }
+
+    void on_accept(beast::error_code ec, tcp::socket socket) {
+        if (ec == net::error::operation_aborted) {
+            return;
+        }
+        if (ec) {
+            std::cerr << "metrics accept: " << ec.message() << "\n";
+        } else {
+            std::make_shared<connection>(std::move(socket), registry_)->run();
+        }
+        if (acceptor_.is_open()) {
+            do_accept();
+        }
+    }
+
+    net::io_context& ioc_;
+    tcp::acceptor acceptor_;
+    metrics::registry& registry_;
+};
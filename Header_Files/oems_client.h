@@ -0,0 +1,103 @@
+#pragma once
+#include "json.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+// In-process order entry API of the deribit_oems library. A strategy links the
+// library and calls these methods directly instead of piping text commands into
+// the CLI:
+//
+//     oems_config config;
+//     config.client_id = "...";
+//     config.client_secret = "...";
+//     oems_client client(config);
+//     client.set_notification_callback([](const std::string& channel, const nlohmann::json& data) { ... });
+//     if (!client.connect()) { ... }
+//     client.subscribe({"ticker.BTC-PERPETUAL.100ms"});
+//     client.place({"BTC-PERPETUAL", order_direction::buy, "limit", 10, 60000.0},
+//                  [](const nlohmann::json& response) { ... });
+//
+// Only Boost-free types appear here; the session, queues and registries stay
+// behind the pointer to implementation. All methods are thread-safe. Callbacks run
+// on the client's I/O threads and must not block.
+
+struct oems_config {
+    std::string host = "test.deribit.com";
+    std::string port = "443";
+    std::string endpoint = "/ws/api/v2";
+    std::string client_id;
+    std::string client_secret;
+    std::string instrument_cache = "instruments.cache";   // empty = no on-disk cache
+    int io_threads = 2;
+    bool verbose = false;                                  // log every frame to stdout
+    std::chrono::milliseconds ping_interval{1000};
+    std::chrono::milliseconds liveness_timeout{5000};      // silence before the link counts as lost
+};
+
+enum class order_direction { buy, sell };
+
+struct order_entry {
+    std::string instrument_name;
+    order_direction direction = order_direction::buy;
+    std::string type = "limit";            // limit, stop_limit, market, stop_market
+    double amount = 0;
+    std::optional<double> price;           // required for limit and stop_limit
+    std::optional<double> trigger_price;   // required for stop orders
+    std::string trigger;                   // index_price, mark_price or last_price
+    std::string label;
+    bool post_only = false;
+    bool reject_post_only = false;
+};
+
+class oems_client {
+public:
+    // Receives the full response, with either "result" or "error", and once the
+    // exchange clock is synchronised "one_way_delay_us" (exchange send to receipt).
+    using response_callback = std::function<void(const nlohmann::json& response)>;
+    // Receives why the connection was lost.
+    using disconnect_callback = std::function<void(const std::string& reason)>;
+    // Receives params.channel and params.data of every subscription notification.
+    using notification_callback = std::function<void(const std::string& channel, const nlohmann::json& data)>;
+
+    explicit oems_client(oems_config config);
+    ~oems_client();
+
+    oems_client(const oems_client&) = delete;
+    oems_client& operator=(const oems_client&) = delete;
+
+    // Must be set before connect().
+    void set_notification_callback(notification_callback callback);
+
+    // Called when the connection drops or goes silent for liveness_timeout. Pending
+    // response callbacks are discarded; connect() may be called again to fail over.
+    // Must be set before connect().
+    void set_disconnect_callback(disconnect_callback callback);
+
+    // Connects, then authenticates when credentials are configured. Returns false
+    // if either step does not complete within timeout.
+    bool connect(std::chrono::milliseconds timeout = std::chrono::seconds(30));
+    bool connected() const;
+    bool authenticated() const;
+
+    // Each request method validates its arguments against the instrument registry
+    // (throwing std::invalid_argument), sends the request and returns its id.
+    std::string place(const order_entry& order, response_callback callback = {});
+    std::string cancel(const std::string& order_id, response_callback callback = {});
+    std::string edit(const std::string& order_id, double amount, std::optional<double> price = std::nullopt,
+                     response_callback callback = {});
+    std::string subscribe(const std::vector<std::string>& channels, response_callback callback = {});
+    std::string unsubscribe(const std::vector<std::string>& channels, response_callback callback = {});
+
+    // Closes the connection and stops the I/O threads; the client cannot connect
+    // again afterwards. Called by the destructor.
+    void close();
+
+private:
+    struct impl;
+    std::unique_ptr<impl> impl_;
+};
@@ -0,0 +1,518 @@
+#pragma once
+#include "common.h"
+#include "json_rpc.h"
+#include "fixed_point.h"
+#include "symbol_table.h"
+
+#include <bit>
+#include <map>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OEMS_HAVE_AVX2_SCAN 1
+#endif
+
+// Order books built from book.* notifications, in integer ticks and lots.
+//
+// map_book is the straightforward version: one std::map per side. ladder_book
+// keeps each side as a price ladder: quantities in a contiguous array indexed by
+// tick offset from an anchor, plus a bitmap of occupied levels, so an update is an
+// array store and a bit flip and the best price is a cached index. When the best
+// level is removed the next one is found by scanning the bitmap, 256 levels per
+// AVX2 test where the CPU has it. Levels outside the window live in a small
+// std::map; the window is recentred when the top of book moves out of it.
+// --bench book compares the two on a capture.
+
+enum class book_side : std::uint8_t { bid, ask };
+
+struct book_level {
+    Price price;
+    Qty qty;
+};
+
+struct book_level_update {
+    book_side side;
+    Price price;
+    Qty qty;   // 0 removes the level
+};
+
+struct book_update {
+    instrument_id instrument = no_symbol;
+    bool snapshot = false;
+    std::int64_t change_id = 0;
+    std::int64_t prev_change_id = 0;   // 0 when the channel has none
+    std::vector<book_level_update> levels;
+};
+
+// Decodes a book.* notification: change sets of [action, price, amount] entries
+// (raw and 100ms channels) or grouped snapshots of [price, amount] entries.
+// Prices and amounts are rounded to the instrument's tick and lot.
+inline bool decode_book_update(const json& notification, const TickTable& ticks, book_update& out) {
+    auto params_it = notification.find("params");
+    if (params_it == notification.end() || !params_it->is_object()) {
+        return false;
+    }
+    auto data_it = params_it->find("data");
+    if (data_it == params_it->end() || !data_it->is_object()) {
+        return false;
+    }
+    const json& data = *data_it;
+    auto name_it = data.find("instrument_name");
+    if (name_it == data.end() || !name_it->is_string()) {
+        return false;
+    }
+
+    out.instrument = instrument_symbols().intern(name_it->get_ref<const std::string&>());
+    out.change_id = data.value("change_id", std::int64_t(0));
+    out.prev_change_id = data.value("prev_change_id", std::int64_t(0));
+    // grouped channels carry no type and always send the whole book
+    out.snapshot = data.value("type", "snapshot") == "snapshot";
+    out.levels.clear();
+
+    const instrument_scale scale = ticks.lookup(out.instrument);
+    for (book_side side : {book_side::bid, book_side::ask}) {
+        auto side_it = data.find(side == book_side::bid ? "bids" : "asks");
+        if (side_it == data.end() || !side_it->is_array()) {
+            continue;
+        }
+        for (const auto& entry : *side_it) {
+            if (!entry.is_array() || entry.size() < 2) {
+                return false;
+            }
+            const bool with_action = entry.size() == 3;
+            const json& price = entry[with_action ? 1 : 0];
+            const json& amount = entry[with_action ? 2 : 1];
+            if (!price.is_number() || !amount.is_number()) {
+                return false;
+            }
+            book_level_update level{side, Price(), Qty()};
+            if (!scale.to_price(price.get<double>(), rounding::nearest, level.price)) {
+                return false;
+            }
+            if (!(with_action && entry[0] == "delete") &&
+                !scale.to_qty(amount.get<double>(), rounding::nearest, level.qty)) {
+                return false;
+            }
+            out.levels.push_back(level);
+        }
+    }
+    return true;
+}
+
+// change_id continuity of one book. Changes are refused until a snapshot arrives,
+// and again after a gap until the next one.
+class book_sequence {
+public:
+    bool accept(const book_update& u) {
+        if (u.snapshot) {
+            last_ = u.change_id;
+            stale_ = false;
+            return true;
+        }
+        if (stale_) {
+            return false;
+        }
+        if (u.prev_change_id != 0 && u.prev_change_id != last_) {
+            stale_ = true;
+            ++gaps_;
+            return false;
+        }
+        last_ = u.change_id;
+        return true;
+    }
+
+    bool stale() const { return stale_; }
+    std::uint64_t gaps() const { return gaps_; }
+
+private:
+    std::int64_t last_ = 0;
+    bool stale_ = true;
+    std::uint64_t gaps_ = 0;
+};
+
+class map_book {
+public:
+    // False when the update was refused (see book_sequence).
+    bool apply(const book_update& u) {
+        if (!sequence_.accept(u)) {
+            return false;
+        }
+        if (u.snapshot) {
+            bids_.clear();
+            asks_.clear();
+        }
+        for (const auto& level : u.levels) {
+            if (level.side == book_side::bid) {
+                set(bids_, level);
+            } else {
+                set(asks_, level);
+            }
+        }
+        return true;
+    }
+
+    std::optional<book_level> best_bid() const { return best(bids_); }
+    std::optional<book_level> best_ask() const { return best(asks_); }
+
+    std::size_t size(book_side side) const {
+        return side == book_side::bid ? bids_.size() : asks_.size();
+    }
+
+    // Up to max levels of one side, best first.
+    template<class F>
+    void for_each(book_side side, std::size_t max, F&& f) const {
+        if (side == book_side::bid) {
+            visit(bids_, max, f);
+        } else {
+            visit(asks_, max, f);
+        }
+    }
+
+    const book_sequence& sequence() const { return sequence_; }
+
+private:
+    template<class Map>
+    static void set(Map& side, const book_level_update& level) {
+        if (level.qty.units() == 0) {
+            side.erase(level.price);
+        } else {
+            side[level.price] = level.qty;
+        }
+    }
+
+    template<class Map>
+    static std::optional<book_level> best(const Map& side) {
+        if (side.empty()) {
+            return std::nullopt;
+        }
+        return book_level{side.begin()->first, side.begin()->second};
+    }
+
+    template<class Map, class F>
+    static void visit(const Map& side, std::size_t max, F& f) {
+        for (auto it = side.begin(); it != side.end() && max > 0; ++it, --max) {
+            f(book_level{it->first, it->second});
+        }
+    }
+
+    std::map<Price, Qty, std::greater<Price>> bids_;
+    std::map<Price, Qty> asks_;
+    book_sequence sequence_;
+};
+
+// Word scans over an occupancy bitmap; -1 when every word in range is zero.
+namespace bitmap_scan {
+
+#ifdef OEMS_HAVE_AVX2_SCAN
+__attribute__((target("avx2")))
+inline std::ptrdiff_t last_nonzero_avx2(const std::uint64_t* words, std::ptrdiff_t end) {
+    std::ptrdiff_t i = end;
+    for (; i >= 4; i -= 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i - 4));
+        if (!_mm256_testz_si256(v, v)) {
+            break;
+        }
+    }
+    for (--i; i >= 0; --i) {
+        if (words[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+inline std::ptrdiff_t first_nonzero_avx2(const std::uint64_t* words, std::ptrdiff_t begin, std::ptrdiff_t count) {
+    std::ptrdiff_t i = begin;
+    for (; i + 4 <= count; i += 4) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i));
+        if (!_mm256_testz_si256(v, v)) {
+            break;
+        }
+    }
+    for (; i < count; ++i) {
+        if (words[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+inline const bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+// Highest index below end whose word is non-zero.
+inline std::ptrdiff_t last_nonzero(const std::uint64_t* words, std::ptrdiff_t end) {
+#ifdef OEMS_HAVE_AVX2_SCAN
+    if (has_avx2) {
+        return last_nonzero_avx2(words, end);
+    }
+#endif
+    for (std::ptrdiff_t i = end - 1; i >= 0; --i) {
+        if (words[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Lowest index in [begin, count) whose word is non-zero.
+inline std::ptrdiff_t first_nonzero(const std::uint64_t* words, std::ptrdiff_t begin, std::ptrdiff_t count) {
+#ifdef OEMS_HAVE_AVX2_SCAN
+    if (has_avx2) {
+        return first_nonzero_avx2(words, begin, count);
+    }
+#endif
+    for (std::ptrdiff_t i = begin; i < count; ++i) {
+        if (words[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+} // namespace bitmap_scan
+
+// One side of a ladder_book. Window index i holds price anchor_ + i; bids keep
+// most of the window below the best price, asks above it.
+template<book_side Side>
+class ladder_side {
+public:
+    // levels is rounded up to a multiple of 256.
+    explicit ladder_side(std::size_t levels)
+        : levels_((std::max<std::size_t>(levels, 256) + 255) / 256 * 256)
+        , qty_(levels_, 0)
+        , bits_(levels_ / 64, 0)
+    {
+    }
+
+    void clear() {
+        std::fill(qty_.begin(), qty_.end(), 0);
+        std::fill(bits_.begin(), bits_.end(), 0);
+        far_.clear();
+        count_ = 0;
+        best_ = -1;
+        anchored_ = false;
+    }
+
+    void set(Price price, Qty qty) {
+        if (!anchored_) {
+            if (qty.units() == 0) {
+                return;
+            }
+            recentre(price);
+        }
+        std::int64_t i = price.units() - anchor_;
+        if (i < 0 || i >= static_cast<std::int64_t>(levels_)) {
+            // a new top of book outside the window moves the window to it
+            if (qty.units() == 0 || (best_ >= 0 && !better(price.units(), anchor_ + best_))) {
+                set_far(price, qty);
+                return;
+            }
+            recentre(price);
+            i = price.units() - anchor_;
+        }
+
+        std::uint64_t& word = bits_[i >> 6];
+        const std::uint64_t bit = std::uint64_t(1) << (i & 63);
+        if (qty.units() == 0) {
+            if (!(word & bit)) {
+                return;
+            }
+            word &= ~bit;
+            qty_[i] = 0;
+            --count_;
+            if (i == best_) {
+                best_ = next_after(i);
+                if (best_ < 0 && !far_.empty()) {
+                    recentre(far_.begin()->first);
+                }
+            }
+            return;
+        }
+        if (!(word & bit)) {
+            word |= bit;
+            ++count_;
+        }
+        qty_[i] = qty.units();
+        if (best_ < 0 || better(i, best_)) {
+            best_ = i;
+        }
+    }
+
+    std::optional<book_level> best() const {
+        if (best_ >= 0) {
+            return book_level{Price(anchor_ + best_), Qty(qty_[best_])};
+        }
+        return std::nullopt;
+    }
+
+    std::size_t size() const { return count_ + far_.size(); }
+
+    std::uint64_t recentres() const { return recentres_; }
+
+    template<class F>
+    void for_each(std::size_t max, F& f) const {
+        for (std::int64_t i = best_; i >= 0 && max > 0; i = next_after(i), --max) {
+            f(book_level{Price(anchor_ + i), Qty(qty_[i])});
+        }
+        for (auto it = far_.begin(); it != far_.end() && max > 0; ++it, --max) {
+            f(book_level{it->first, it->second});
+        }
+    }
+
+private:
+    using far_map = std::conditional_t<Side == book_side::bid,
+        std::map<Price, Qty, std::greater<Price>>, std::map<Price, Qty>>;
+
+    static constexpr bool better(std::int64_t a, std::int64_t b) {
+        return Side == book_side::bid ? a > b : a < b;
+    }
+
+    void set_far(Price price, Qty qty) {
+        if (qty.units() == 0) {
+            far_.erase(price);
+        } else {
+            far_[price] = qty;
+        }
+    }
+
+    // Next occupied index after i in the direction away from the spread.
+    std::int64_t next_after(std::int64_t i) const {
+        if constexpr (Side == book_side::bid) {
+            std::ptrdiff_t w = i >> 6;
+            std::uint64_t below = bits_[w] & ((std::uint64_t(1) << (i & 63)) - 1);
+            if (!below) {
+                w = bitmap_scan::last_nonzero(bits_.data(), w);
+                if (w < 0) {
+                    return -1;
+                }
+                below = bits_[w];
+            }
+            return w * 64 + 63 - std::countl_zero(below);
+        } else {
+            std::ptrdiff_t w = i >> 6;
+            std::uint64_t above = (i & 63) == 63 ? 0 : bits_[w] & (~std::uint64_t(0) << ((i & 63) + 1));
+            if (!above) {
+                w = bitmap_scan::first_nonzero(bits_.data(), w + 1, static_cast<std::ptrdiff_t>(bits_.size()));
+                if (w < 0) {
+                    return -1;
+                }
+                above = bits_[w];
+            }
+            return w * 64 + std::countr_zero(above);
+        }
+    }
+
+    // Moves the window so top sits 1/8 of it from the spread-side edge; levels
+    // that leave the window go to far_, far levels inside it come in.
+    void recentre(Price top) {
+        const auto n = static_cast<std::int64_t>(levels_);
+        const std::int64_t headroom = n / 8;
+        const std::int64_t anchor = Side == book_side::bid ? top.units() - (n - 1 - headroom) : top.units() - headroom;
+
+        std::vector<book_level> window;
+        window.reserve(count_);
+        for (std::size_t w = 0; w < bits_.size(); ++w) {
+            for (std::uint64_t b = bits_[w]; b; b &= b - 1) {
+                std::int64_t i = static_cast<std::int64_t>(w * 64) + std::countr_zero(b);
+                window.push_back({Price(anchor_ + i), Qty(qty_[i])});
+                qty_[i] = 0;
+            }
+            bits_[w] = 0;
+        }
+        if (anchored_) {
+            ++recentres_;
+        }
+        anchored_ = true;
+        anchor_ = anchor;
+        count_ = 0;
+        best_ = -1;
+
+        const Price lo(anchor), hi(anchor + n - 1);
+        auto first = Side == book_side::bid ? far_.lower_bound(hi) : far_.lower_bound(lo);
+        auto last = Side == book_side::bid ? far_.upper_bound(lo) : far_.upper_bound(hi);
+        for (auto it = first; it != last; ++it) {
+            window.push_back({it->first, it->second});
+        }
+        far_.erase(first, last);
+
+        for (const auto& level : window) {
+            std::int64_t i = level.price.units() - anchor_;
+            if (i < 0 || i >= n) {
+                far_[level.price] = level.qty;
+                continue;
+            }
+            bits_[i >> 6] |= std::uint64_t(1) << (i & 63);
+            qty_[i] = level.qty.units();
+            ++count_;
+            if (best_ < 0 || better(i, best_)) {
+                best_ = i;
+            }
+        }
+    }
+
+    std::size_t levels_;
+    std::vector<std::int64_t> qty_;      // lots per level, 0 = empty
+    std::vector<std::uint64_t> bits_;    // occupied levels
+    std::int64_t anchor_ = 0;            // price of index 0, in ticks
+    std::int64_t best_ = -1;             // index of the best level, -1 = window empty
+    std::size_t count_ = 0;              // occupied levels in the window
+    bool anchored_ = false;
+    std::uint64_t recentres_ = 0;
+    far_map far_;                        // levels outside the window
+};
+
+class ladder_book {
+public:
+    // levels per side; a window of 4096 covers 2048 USD of BTC-PERPETUAL at 0.5 ticks.
+    explicit ladder_book(std::size_t levels = 4096)
+        : bids_(levels)
+        , asks_(levels)
+    {
+    }
+
+    // False when the update was refused (see book_sequence).
+    bool apply(const book_update& u) {
+        if (!sequence_.accept(u)) {
+            return false;
+        }
+        if (u.snapshot) {
+            bids_.clear();
+            asks_.clear();
+        }
+        for (const auto& level : u.levels) {
+            if (level.side == book_side::bid) {
+                bids_.set(level.price, level.qty);
+            } else {
+                asks_.set(level.price, level.qty);
+            }
+        }
+        return true;
+    }
+
+    std::optional<book_level> best_bid() const { return bids_.best(); }
+    std::optional<book_level> best_ask() const { return asks_.best(); }
+
+    std::size_t size(book_side side) const {
+        return side == book_side::bid ? bids_.size() : asks_.size();
+    }
+
+    template<class F>
+    void for_each(book_side side, std::size_t max, F&& f) const {
+        if (side == book_side::bid) {
+            bids_.for_each(max, f);
+        } else {
+            asks_.for_each(max, f);
+        }
+    }
+
+    std::uint64_t recentres() const { return bids_.recentres() + asks_.recentres(); }
+
+    const book_sequence& sequence() const { return sequence_; }
+
+private:
+    ladder_side<book_side::bid> bids_;
+    ladder_side<book_side::ask> asks_;
+    book_sequence sequence_;
+};
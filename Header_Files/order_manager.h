@@ -0,0 +1,154 @@
+#pragma once
+#include "common.h"
+#include "json_rpc.h"
+#include "symbol_table.h"
+
+// Last known state of an order placed or amended through this session.
+struct tracked_order {
+    std::string order_id;
+    instrument_id instrument = no_symbol;
+    std::string direction;
+    std::string order_type;
+    std::string order_state;
+    double price = 0;
+    double amount = 0;
+    double filled_amount = 0;
+    std::uint64_t last_update_timestamp = 0;
+    unsigned edits = 0;
+
+    std::string_view instrument_name() const { return instrument_symbols().name(instrument); }
+};
+
+// Correlates outgoing order requests (buy/sell/edit/cancel) with their responses
+// and keeps the resulting order state keyed by order_id.
+// track_request is called from the CLI thread, on_response from the websocket strand.
+class OrderManager {
+public:
+    void track_request(const json& request) {
+        auto method_it = request.find("method");
+        auto id_it = request.find("id");
+        if (method_it == request.end() || id_it == request.end()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        pending_[id_it->get<std::string>()] = method_it->get<std::string>();
+    }
+
+    // Returns true when the response belonged to a tracked order request.
+    bool on_response(const json& response) {
+        auto id_it = response.find("id");
+        if (id_it == response.end() || !id_it->is_string()) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto pending_it = pending_.find(id_it->get<std::string>());
+        if (pending_it == pending_.end()) {
+            return false;
+        }
+        std::string method = std::move(pending_it->second);
+        pending_.erase(pending_it);
+
+        auto error_it = response.find("error");
+        if (error_it != response.end()) {
+            rejects_.fetch_add(1, std::memory_order_relaxed);
+            std::cerr << method << " rejected: " << error_it->dump() << "\n";
+            return true;
+        }
+
+        auto result_it = response.find("result");
+        if (result_it == response.end()) {
+            return true;
+        }
+
+        // buy/sell/edit return {order, trades}, cancel returns the order itself
+        auto order_it = result_it->find("order");
+        const json& order = order_it != result_it->end() ? *order_it : *result_it;
+        apply_order_locked(order, method == "private/edit");
+        return true;
+    }
+
+    // Applies an order object as published by the exchange (responses or user.orders.* notifications).
+    void apply_order(const json& order) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        apply_order_locked(order, false);
+    }
+
+    std::optional<tracked_order> find(const std::string& order_id) const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto it = orders_.find(order_id);
+        if (it == orders_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    std::vector<tracked_order> snapshot() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        std::vector<tracked_order> orders;
+        orders.reserve(orders_.size());
+        for (const auto& [id, order] : orders_) {
+            orders.push_back(order);
+        }
+        return orders;
+    }
+
+    std::size_t pending_count() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return pending_.size();
+    }
+
+    // Lock-free, for metrics scrapes.
+    std::uint64_t rejects() const {
+        return rejects_.load(std::memory_order_relaxed);
+    }
+
+    void print(std::ostream& os) const {
+        for (const auto& o : snapshot()) {
+            os << o.order_id << "  " << o.instrument_name() << "  " << o.direction << " " << o.order_type
+               << "  price=" << o.price << "  amount=" << o.amount << "  filled=" << o.filled_amount
+               << "  state=" << o.order_state << "  edits=" << o.edits << "\n";
+        }
+        os << "pending requests: " << pending_count() << "\n";
+    }
+
+private:
+    template <typename T>
+    static void read_field(const json& order, const char* key, T& out) {
+        auto it = order.find(key);
+        if (it != order.end() && !it->is_null()) {
+            out = it->get<T>();
+        }
+    }
+
+    void apply_order_locked(const json& order, bool is_edit) {
+        if (!order.is_object() || !order.contains("order_id")) {
+            return;
+        }
+        tracked_order& o = orders_[order["order_id"].get<std::string>()];
+        o.order_id = order["order_id"].get<std::string>();
+        auto instrument_it = order.find("instrument_name");
+        if (instrument_it != order.end() && instrument_it->is_string()) {
+            o.instrument = instrument_symbols().intern(instrument_it->get_ref<const std::string&>());
+        }
+        read_field(order, "direction", o.direction);
+        read_field(order, "order_type", o.order_type);
+        read_field(order, "order_state", o.order_state);
+        read_field(order, "amount", o.amount);
+        read_field(order, "filled_amount", o.filled_amount);
+        read_field(order, "last_update_timestamp", o.last_update_timestamp);
+        // market orders report price as the string "market_price"
+        auto price_it = order.find("price");
+        if (price_it != order.end() && price_it->is_number()) {
+            o.price = price_it->get<double>();
+        }
+        if (is_edit) {
+            ++o.edits;
+        }
+    }
+
+    mutable std::mutex mtx_;
+    std::unordered_map<std::string, std::string> pending_;   // request id -> method
+    std::unordered_map<std::string, tracked_order> orders_;  // order id -> state
+    std::atomic<std::uint64_t> rejects_{0};
+};
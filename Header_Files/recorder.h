@@ -0,0 +1,262 @@
+#pragma once
+#include "common.h"
+#include "tsc_clock.h"
+
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// On-disk layout of a capture segment:
+//   segment_header, then records of frame_record_header + payload, each padded to 8 bytes.
+// Segments are preallocated and zero-filled, so a zero length marks the end of data.
+struct segment_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t segment_index;
+    std::uint64_t created_wall_ns;
+};
+
+struct frame_record_header {
+    std::uint64_t steady_ns;       // receive time, steady clock
+    std::uint64_t wall_ns;         // receive time, system clock (ns since epoch)
+    std::uint32_t connection_id;
+    std::uint32_t length;          // payload bytes
+};
+
+constexpr char segment_magic[8] = {'D', 'R', 'B', 'R', 'E', 'C', '1', '\0'};
+constexpr std::uint32_t segment_version = 1;
+
+inline std::size_t record_size(std::size_t payload) {
+    return (sizeof(frame_record_header) + payload + 7) & ~std::size_t(7);
+}
+
+inline std::string segment_path(const std::string& prefix, std::uint32_t index) {
+    char suffix[32];
+    std::snprintf(suffix, sizeof(suffix), ".%06u.seg", index);
+    return prefix + suffix;
+}
+
+struct recorder_stats {
+    std::uint64_t frames_recorded = 0;
+    std::uint64_t frames_dropped = 0;
+    std::uint64_t bytes_written = 0;
+    std::uint32_t segments = 0;
+};
+
+// Captures raw WebSocket frames without blocking the read strand.
+// record() copies the frame into an in-memory ring and returns; a writer thread drains
+// the ring in batches into a preallocated, memory-mapped segment file and rolls to a new
+// segment when full. When the writer falls behind and the ring is full, frames are
+// dropped and counted rather than delaying the caller.
+class FrameRecorder {
+public:
+    explicit FrameRecorder(std::string prefix,
+                           std::size_t ring_bytes = std::size_t(1) << 24,
+                           std::size_t segment_bytes = std::size_t(1) << 28)
+        : prefix_(std::move(prefix))
+        , ring_(round_up_pow2(ring_bytes))
+        , mask_(ring_.size() - 1)
+        , segment_bytes_(segment_bytes)
+    {
+        if (!open_segment()) {
+            throw std::runtime_error("Cannot create capture segment " + segment_path(prefix_, 0));
+        }
+        writer_ = std::thread([this] { writer_loop(); });
+    }
+
+    ~FrameRecorder() {
+        stop();
+    }
+
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+    // Producer side. Safe to call from several sessions; the spin lock only guards the ring copy.
+    void record(std::uint32_t connection_id, const void* data, std::size_t size) {
+        frame_record_header h;
+        h.steady_ns = tsc_clock::to_steady_ns(tsc_clock::now());
+        h.wall_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        h.connection_id = connection_id;
+        h.length = static_cast<std::uint32_t>(size);
+
+        std::size_t total = record_size(size);
+        while (producer_lock_.test_and_set(std::memory_order_acquire)) {
+        }
+        std::uint64_t head = head_.load(std::memory_order_relaxed);
+        std::uint64_t tail = tail_.load(std::memory_order_acquire);
+        if (total > ring_.size() - (head - tail) || !running_.load(std::memory_order_relaxed)) {
+            producer_lock_.clear(std::memory_order_release);
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        copy_in(head, &h, sizeof(h));
+        copy_in(head + sizeof(h), data, size);
+        head_.store(head + total, std::memory_order_release);
+        producer_lock_.clear(std::memory_order_release);
+    }
+
+    // Flushes what is buffered, closes the current segment and joins the writer.
+    void stop() {
+        if (!running_.exchange(false)) {
+            return;
+        }
+        if (writer_.joinable()) {
+            writer_.join();
+        }
+        close_segment();
+    }
+
+    recorder_stats stats() const {
+        recorder_stats s;
+        s.frames_recorded = recorded_.load(std::memory_order_relaxed);
+        s.frames_dropped = dropped_.load(std::memory_order_relaxed);
+        s.bytes_written = bytes_written_.load(std::memory_order_relaxed);
+        s.segments = segments_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    const std::string& prefix() const { return prefix_; }
+
+private:
+    static std::size_t round_up_pow2(std::size_t n) {
+        std::size_t p = 4096;
+        while (p < n) {
+            p <<= 1;
+        }
+        return p;
+    }
+
+    void copy_in(std::uint64_t pos, const void* src, std::size_t n) {
+        std::size_t offset = pos & mask_;
+        std::size_t first = std::min(n, ring_.size() - offset);
+        std::memcpy(ring_.data() + offset, src, first);
+        std::memcpy(ring_.data(), static_cast<const char*>(src) + first, n - first);
+    }
+
+    void copy_out(std::uint64_t pos, void* dst, std::size_t n) const {
+        std::size_t offset = pos & mask_;
+        std::size_t first = std::min(n, ring_.size() - offset);
+        std::memcpy(dst, ring_.data() + offset, first);
+        std::memcpy(static_cast<char*>(dst) + first, ring_.data(), n - first);
+    }
+
+    bool open_segment() {
+        std::string path = segment_path(prefix_, segment_index_);
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        if (::ftruncate(fd, static_cast<off_t>(segment_bytes_)) != 0) {
+            ::close(fd);
+            return false;
+        }
+        void* base = ::mmap(nullptr, segment_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+        segment_fd_ = fd;
+        segment_ = static_cast<char*>(base);
+
+        segment_header header{};
+        std::memcpy(header.magic, segment_magic, sizeof(header.magic));
+        header.version = segment_version;
+        header.segment_index = segment_index_;
+        header.created_wall_ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        std::memcpy(segment_, &header, sizeof(header));
+        segment_used_ = sizeof(header);
+        segments_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // Trims the segment to the bytes actually written.
+    void close_segment() {
+        if (!segment_) {
+            return;
+        }
+        ::msync(segment_, segment_used_, MS_ASYNC);
+        ::munmap(segment_, segment_bytes_);
+        if (::ftruncate(segment_fd_, static_cast<off_t>(segment_used_)) != 0) {
+            std::cerr << "Failed to trim capture segment " << segment_path(prefix_, segment_index_) << "\n";
+        }
+        ::close(segment_fd_);
+        segment_ = nullptr;
+        segment_fd_ = -1;
+    }
+
+    // Moves every complete record between tail and head into the segment in one pass.
+    bool drain() {
+        std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+        std::uint64_t head = head_.load(std::memory_order_acquire);
+        if (tail == head) {
+            return false;
+        }
+        while (tail != head) {
+            frame_record_header h;
+            copy_out(tail, &h, sizeof(h));
+            std::size_t total = record_size(h.length);
+
+            // keep one zeroed header free at the end of a segment as the terminator
+            if (segment_used_ + total + sizeof(frame_record_header) > segment_bytes_) {
+                close_segment();
+                ++segment_index_;
+                if (!open_segment()) {
+                    std::cerr << "Cannot create capture segment " << segment_path(prefix_, segment_index_) << "\n";
+                    running_.store(false);
+                    tail_.store(head, std::memory_order_release);
+                    return false;
+                }
+                if (segment_used_ + total + sizeof(frame_record_header) > segment_bytes_) {
+                    // larger than a whole segment: cannot be stored
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    tail += total;
+                    continue;
+                }
+            }
+            copy_out(tail, segment_ + segment_used_, total);
+            segment_used_ += total;
+            tail += total;
+            recorded_.fetch_add(1, std::memory_order_relaxed);
+            bytes_written_.fetch_add(total, std::memory_order_relaxed);
+        }
+        tail_.store(tail, std::memory_order_release);
+        return true;
+    }
+
+    void writer_loop() {
+        while (running_.load(std::memory_order_acquire)) {
+            if (!drain()) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        }
+        // take the producer lock so no record is half-written while draining the rest
+        while (producer_lock_.test_and_set(std::memory_order_acquire)) {
+        }
+        drain();
+        producer_lock_.clear(std::memory_order_release);
+    }
+
+    std::string prefix_;
+    std::vector<char> ring_;
+    std::size_t mask_;
+    std::atomic<std::uint64_t> head_{0};
+    std::atomic<std::uint64_t> tail_{0};
+    std::atomic_flag producer_lock_ = ATOMIC_FLAG_INIT;
+    std::atomic<bool> running_{true};
+
+    std::size_t segment_bytes_;
+    std::uint32_t segment_index_ = 0;
+    int segment_fd_ = -1;
+    char* segment_ = nullptr;
+    std::size_t segment_used_ = 0;
+
+    std::atomic<std::uint64_t> recorded_{0};
+    std::atomic<std::uint64_t> dropped_{0};
+    std::atomic<std::uint64_t> bytes_written_{0};
+    std::atomic<std::uint32_t> segments_{0};
+    std::thread writer_;
+};
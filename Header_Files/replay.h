@@ -0,0 +1,169 @@
+#pragma once
+#include "common.h"
+#include "recorder.h"
+#include "dispatcher.h"
+
+#include <sys/stat.h>
+
+// Sequential reader over the segment files written by FrameRecorder.
+class capture_reader {
+public:
+    explicit capture_reader(std::string prefix)
+        : prefix_(std::move(prefix))
+    {
+    }
+
+    ~capture_reader() {
+        unmap();
+    }
+
+    capture_reader(const capture_reader&) = delete;
+    capture_reader& operator=(const capture_reader&) = delete;
+
+    // Returns false at the end of the capture. payload stays valid until the next call.
+    bool next(frame_record_header& header, std::string_view& payload) {
+        for (;;) {
+            if (!segment_ && !map_segment(next_index_++)) {
+                return false;
+            }
+            if (pos_ + sizeof(frame_record_header) <= size_) {
+                std::memcpy(&header, segment_ + pos_, sizeof(header));
+                std::size_t total = record_size(header.length);
+                if (header.length != 0 && pos_ + sizeof(header) + header.length <= size_) {
+                    payload = std::string_view(segment_ + pos_ + sizeof(header), header.length);
+                    pos_ += total;
+                    return true;
+                }
+            }
+            unmap();
+        }
+    }
+
+    std::uint32_t segments_read() const { return next_index_; }
+
+private:
+    bool map_segment(std::uint32_t index) {
+        std::string path = segment_path(prefix_, index);
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(segment_header)) {
+            ::close(fd);
+            return false;
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        void* base = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        segment_ = static_cast<const char*>(base);
+        ::madvise(base, size_, MADV_SEQUENTIAL);
+
+        segment_header header;
+        std::memcpy(&header, segment_, sizeof(header));
+        if (std::memcmp(header.magic, segment_magic, sizeof(header.magic)) != 0 || header.version != segment_version) {
+            std::cerr << path << ": not a capture segment\n";
+            unmap();
+            return false;
+        }
+        pos_ = sizeof(segment_header);
+        return true;
+    }
+
+    void unmap() {
+        if (segment_) {
+            ::munmap(const_cast<char*>(segment_), size_);
+            segment_ = nullptr;
+        }
+    }
+
+    std::string prefix_;
+    std::uint32_t next_index_ = 0;
+    const char* segment_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t pos_ = 0;
+};
+
+struct replay_stats {
+    std::uint64_t frames = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t parse_errors = 0;
+    std::uint64_t elapsed_ns = 0;     // wall time spent replaying, including pacing
+    std::uint64_t busy_ns = 0;        // time spent inside dispatch
+    std::uint64_t max_lag_ns = 0;     // worst delay behind the paced schedule
+
+    void print(std::ostream& os) const {
+        double busy_s = busy_ns / 1e9;
+        os << "Replayed " << frames << " frames (" << bytes << " bytes) in " << elapsed_ns / 1e6 << " ms, "
+           << "parse errors " << parse_errors << "\n";
+        if (frames > 0 && busy_ns > 0) {
+            os << "  dispatch: " << busy_ns / frames << " ns/frame, " << frames / busy_s << " frames/s, "
+               << bytes / busy_s / (1 << 20) << " MiB/s\n";
+        }
+        if (max_lag_ns > 0) {
+            os << "  max lag behind schedule: " << max_lag_ns / 1e3 << " us\n";
+        }
+    }
+};
+
+// Feeds captured frames through a frame_dispatcher without any network.
+// speed == 0 replays as fast as possible; otherwise inter-frame gaps from the
+// capture's steady clock are reproduced, divided by speed (1 = real time).
+class ReplayEngine {
+public:
+    explicit ReplayEngine(frame_dispatcher& dispatcher)
+        : dispatcher_(dispatcher)
+    {
+    }
+
+    replay_stats run(const std::string& prefix, double speed = 0) {
+        using clock = std::chrono::steady_clock;
+        capture_reader reader(prefix);
+        replay_stats stats;
+        std::uint64_t parse_errors_before = dispatcher_.parse_errors();
+
+        frame_record_header header;
+        std::string_view payload;
+        std::uint64_t first_capture_ns = 0;
+        auto start = clock::now();
+
+        while (reader.next(header, payload)) {
+            if (speed > 0) {
+                if (stats.frames == 0) {
+                    first_capture_ns = header.steady_ns;
+                }
+                auto due = start + std::chrono::nanoseconds(
+                    static_cast<std::int64_t>((header.steady_ns - first_capture_ns) / speed));
+                wait_until(due);
+                auto lag = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - due).count();
+                stats.max_lag_ns = std::max<std::uint64_t>(stats.max_lag_ns, lag > 0 ? lag : 0);
+            }
+
+            auto t0 = clock::now();
+            dispatcher_.dispatch(payload);
+            stats.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+            ++stats.frames;
+            stats.bytes += payload.size();
+        }
+
+        stats.elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+        stats.parse_errors = dispatcher_.parse_errors() - parse_errors_before;
+        return stats;
+    }
+
+private:
+    // Sleeps for long gaps and spins the last stretch to keep pacing tight.
+    static void wait_until(std::chrono::steady_clock::time_point due) {
+        auto now = std::chrono::steady_clock::now();
+        if (due - now > std::chrono::microseconds(200)) {
+            std::this_thread::sleep_until(due - std::chrono::microseconds(100));
+        }
+        while (std::chrono::steady_clock::now() < due) {
+        }
+    }
+
+    frame_dispatcher& dispatcher_;
+};
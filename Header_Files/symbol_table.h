@@ -0,0 +1,111 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Process-wide interning of instrument names and currencies into dense 32-bit
+// ids. Internal structures (instrument registry, tick table, tracked orders) are
+// keyed by id and store no names; a name is looked up again only to encode or
+// print it. Ids are never reused and names never move, so name() needs no lock
+// and its string_view stays valid for the life of the process.
+//
+// intern() and find() take a shared lock and only intern() of a new name takes
+// the exclusive one, which after warm-up (the instrument refresh interns the
+// whole universe) no longer happens.
+using symbol_id = std::uint32_t;
+
+inline constexpr symbol_id no_symbol = ~symbol_id(0);
+
+class symbol_table {
+public:
+    symbol_table() = default;
+    symbol_table(const symbol_table&) = delete;
+    symbol_table& operator=(const symbol_table&) = delete;
+
+    ~symbol_table() {
+        for (auto& chunk : chunks_) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
+
+    symbol_id intern(std::string_view name) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mtx_);
+            auto it = ids_.find(name);
+            if (it != ids_.end()) {
+                return it->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mtx_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        auto id = static_cast<symbol_id>(size_.load(std::memory_order_relaxed));
+        if (id >= chunk_size * max_chunks) {
+            throw std::length_error("symbol table full");
+        }
+        std::string* chunk = chunks_[id / chunk_size].load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new std::string[chunk_size];
+            chunks_[id / chunk_size].store(chunk, std::memory_order_release);
+        }
+        std::string& stored = chunk[id % chunk_size];
+        stored.assign(name);
+        // keyed by a view of the stored copy, which never moves
+        ids_.emplace(std::string_view(stored), id);
+        size_.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    std::optional<symbol_id> find(std::string_view name) const {
+        std::shared_lock<std::shared_mutex> lock(mtx_);
+        auto it = ids_.find(name);
+        if (it == ids_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    // Empty for no_symbol or an id this table did not hand out.
+    std::string_view name(symbol_id id) const noexcept {
+        if (id >= size_.load(std::memory_order_acquire)) {
+            return {};
+        }
+        return chunks_[id / chunk_size].load(std::memory_order_acquire)[id % chunk_size];
+    }
+
+    std::size_t size() const noexcept {
+        return size_.load(std::memory_order_acquire);
+    }
+
+private:
+    static constexpr std::size_t chunk_size = 4096;
+    static constexpr std::size_t max_chunks = 4096;   // 16M symbols
+
+    mutable std::shared_mutex mtx_;
+    std::unordered_map<std::string_view, symbol_id> ids_;
+    std::array<std::atomic<std::string*>, max_chunks> chunks_{};
+    std::atomic<std::size_t> size_{0};
+};
+
+using instrument_id = symbol_id;
+using currency_id = symbol_id;
+
+inline symbol_table& instrument_symbols() {
+    static symbol_table table;
+    return table;
+}
+
+inline symbol_table& currency_symbols() {
+    static symbol_table table;
+    return table;
+}
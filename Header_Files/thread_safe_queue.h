@@ -0,0 +1,303 @@
+#pragma once
+#include "json_rpc.h"
+#include "common.h"
+#include "tsc_clock.h"
+#include "lazy_json.h"
+
+// What push() does when a bounded queue is full.
+enum class overflow_policy {
+    block,        // wait for the consumer
+    drop_oldest,  // evict the head to make room
+    drop_newest,  // discard the value being pushed
+    disconnect    // reject and report overflow so the producer can escalate
+};
+
+inline const char* to_string(overflow_policy policy) {
+    switch (policy) {
+        case overflow_policy::block: return "block";
+        case overflow_policy::drop_oldest: return "drop_oldest";
+        case overflow_policy::drop_newest: return "drop_newest";
+        case overflow_policy::disconnect: return "disconnect";
+    }
+    return "unknown";
+}
+
+inline overflow_policy parse_overflow_policy(const std::string& name) {
+    if (name == "block") return overflow_policy::block;
+    if (name == "drop_oldest") return overflow_policy::drop_oldest;
+    if (name == "drop_newest") return overflow_policy::drop_newest;
+    if (name == "disconnect") return overflow_policy::disconnect;
+    throw std::invalid_argument("Invalid policy '" + name + "'. Must be one of block, drop_oldest, drop_newest, disconnect.");
+}
+
+enum class push_result { ok, dropped_oldest, dropped_newest, overflow };
+
+struct queue_stats {
+    std::size_t size = 0;
+    std::size_t capacity = 0;          // 0 = unbounded
+    std::size_t high_water = 0;
+    std::uint64_t pushes = 0;
+    std::uint64_t pops = 0;
+    std::uint64_t drops = 0;
+    std::uint64_t overflows = 0;       // pushes rejected under overflow_policy::disconnect
+    std::uint64_t lock_wait_ns = 0;    // time spent acquiring a contended lock
+    std::uint64_t producer_wait_ns = 0;// time producers blocked on a full queue
+    std::uint64_t consumer_wait_ns = 0;// time consumers blocked on an empty queue
+    overflow_policy policy = overflow_policy::block;
+    bool conflating = false;           // last-value queue: capacity = keys, drops = conflated
+};
+
+template <typename T> class ThreadSafeQueue {
+public:
+    explicit ThreadSafeQueue(std::size_t capacity = 0, overflow_policy policy = overflow_policy::block)
+        : capacity_(capacity)
+        , policy_(policy)
+    {
+    }
+
+    push_result push(T value) {
+        std::unique_lock<std::mutex> lock = acquire();
+        push_result result = push_result::ok;
+        if (capacity_ != 0 && queue_.size() >= capacity_) {
+            switch (policy_) {
+                case overflow_policy::block: {
+                    tsc_clock::ticks t0 = tsc_clock::now();
+                    not_full_.wait(lock, [this] { return capacity_ == 0 || queue_.size() < capacity_; });
+                    producer_wait_ticks_ += elapsed_ticks(t0);
+                    break;
+                }
+                case overflow_policy::drop_oldest:
+                    queue_.pop();
+                    ++drops_;
+                    result = push_result::dropped_oldest;
+                    break;
+                case overflow_policy::drop_newest:
+                    ++drops_;
+                    return push_result::dropped_newest;
+                case overflow_policy::disconnect:
+                    ++overflows_;
+                    return push_result::overflow;
+            }
+        }
+        queue_.push(std::move(value));
+        ++pushes_;
+        high_water_ = std::max(high_water_, queue_.size());
+        depth_.store(queue_.size(), std::memory_order_relaxed);
+        cond_var_.notify_one();
+        return result;
+    }
+
+    bool try_pop(T& value) {
+        std::unique_lock<std::mutex> lock = acquire();
+        if (queue_.empty()) {
+            return false;
+        }
+        take(value);
+        return true;
+    }
+
+    void wait_and_pop(T& value) {
+        std::unique_lock<std::mutex> lock = acquire();
+        if (queue_.empty()) {
+            tsc_clock::ticks t0 = tsc_clock::now();
+            cond_var_.wait(lock, [this] { return !queue_.empty(); });
+            consumer_wait_ticks_ += elapsed_ticks(t0);
+        }
+        take(value);
+    }
+
+    // Changing the capacity or policy wakes blocked producers so they re-check.
+    void configure(std::size_t capacity, overflow_policy policy) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        capacity_ = capacity;
+        policy_ = policy;
+        not_full_.notify_all();
+    }
+
+    // Current size without taking the lock, for metrics scrapes.
+    std::size_t depth() const noexcept {
+        return depth_.load(std::memory_order_relaxed);
+    }
+
+    queue_stats stats() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        queue_stats s;
+        s.size = queue_.size();
+        s.capacity = capacity_;
+        s.high_water = high_water_;
+        s.pushes = pushes_;
+        s.pops = pops_;
+        s.drops = drops_;
+        s.overflows = overflows_;
+        s.lock_wait_ns = static_cast<std::uint64_t>(tsc_clock::to_ns(lock_wait_ticks_));
+        s.producer_wait_ns = static_cast<std::uint64_t>(tsc_clock::to_ns(producer_wait_ticks_));
+        s.consumer_wait_ns = static_cast<std::uint64_t>(tsc_clock::to_ns(consumer_wait_ticks_));
+        s.policy = policy_;
+        return s;
+    }
+
+private:
+    // Waits are kept in ticks and converted when stats() is read.
+    static tsc_clock::ticks elapsed_ticks(tsc_clock::ticks t0) {
+        tsc_clock::ticks t1 = tsc_clock::now();
+        return t1 > t0 ? t1 - t0 : 0;
+    }
+
+    // Only a contended acquisition pays for the clock reads.
+    std::unique_lock<std::mutex> acquire() {
+        std::unique_lock<std::mutex> lock(mtx_, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            tsc_clock::ticks t0 = tsc_clock::now();
+            lock.lock();
+            lock_wait_ticks_ += elapsed_ticks(t0);
+        }
+        return lock;
+    }
+
+    void take(T& value) {
+        value = std::move(queue_.front());
+        queue_.pop();
+        ++pops_;
+        depth_.store(queue_.size(), std::memory_order_relaxed);
+        if (capacity_ != 0) {
+            not_full_.notify_one();
+        }
+    }
+
+    std::queue<T>           queue_;
+    mutable std::mutex      mtx_;
+    std::condition_variable cond_var_;
+    std::condition_variable not_full_;
+    std::size_t             capacity_;
+    overflow_policy         policy_;
+    std::size_t             high_water_ = 0;
+    std::uint64_t           pushes_ = 0;
+    std::uint64_t           pops_ = 0;
+    std::uint64_t           drops_ = 0;
+    std::uint64_t           overflows_ = 0;
+    tsc_clock::ticks        lock_wait_ticks_ = 0;
+    tsc_clock::ticks        producer_wait_ticks_ = 0;
+    tsc_clock::ticks        consumer_wait_ticks_ = 0;
+    std::atomic<std::size_t> depth_{0};
+};
+
+using RpcQueue = ThreadSafeQueue<lazy_json>;
+
+// Last-value queue keyed by K. push() overwrites the pending value of its key, so
+// a slow consumer only ever sees the most recent value per key together with the
+// number of updates that were conflated into it. Memory is bounded by the number
+// of distinct keys; keys are handed out in the order they first became pending.
+template <typename K, typename T> class ConflatingQueue {
+public:
+    void push(const K& key, T value) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        ++pushes_;
+        slot& s = slots_[key];
+        if (s.pending) {
+            s.value = std::move(value);
+            ++s.conflated;
+            ++total_conflated_;
+            return;
+        }
+        if (s.key == nullptr) {
+            s.key = &slots_.find(key)->first;
+        }
+        s.value = std::move(value);
+        s.conflated = 0;
+        s.pending = true;
+        ready_.push_back(&s);
+        high_water_ = std::max(high_water_, ready_.size());
+        depth_.store(ready_.size(), std::memory_order_relaxed);
+        cond_var_.notify_one();
+    }
+
+    bool try_pop(K& key, T& value, std::uint64_t& conflated) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (ready_.empty()) {
+            return false;
+        }
+        take(key, value, conflated);
+        return true;
+    }
+
+    void wait_and_pop(K& key, T& value, std::uint64_t& conflated) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cond_var_.wait(lock, [this] { return !ready_.empty(); });
+        take(key, value, conflated);
+    }
+
+    // Number of keys with a pending value.
+    std::size_t pending() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return ready_.size();
+    }
+
+    // pending() without taking the lock, for metrics scrapes.
+    std::size_t depth() const noexcept {
+        return depth_.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t total_conflated() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return total_conflated_;
+    }
+
+    // size is the number of pending keys and capacity the number of keys seen;
+    // conflated updates are reported as drops.
+    queue_stats stats() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        queue_stats s;
+        s.size = ready_.size();
+        s.capacity = slots_.size();
+        s.high_water = high_water_;
+        s.pushes = pushes_;
+        s.pops = pops_;
+        s.drops = total_conflated_;
+        s.conflating = true;
+        return s;
+    }
+
+private:
+    struct slot {
+        const K* key = nullptr;
+        T value{};
+        std::uint64_t conflated = 0;
+        bool pending = false;
+    };
+
+    void take(K& key, T& value, std::uint64_t& conflated) {
+        slot* s = ready_.front();
+        ready_.pop_front();
+        ++pops_;
+        depth_.store(ready_.size(), std::memory_order_relaxed);
+        key = *s->key;
+        value = std::move(s->value);
+        conflated = s->conflated;
+        s->pending = false;
+    }
+
+    std::unordered_map<K, slot> slots_;   // node-based: slot addresses stay valid
+    std::deque<slot*>           ready_;
+    std::uint64_t               total_conflated_ = 0;
+    std::uint64_t               pushes_ = 0;
+    std::uint64_t               pops_ = 0;
+    std::size_t                 high_water_ = 0;
+    std::atomic<std::size_t>    depth_{0};
+    mutable std::mutex          mtx_;
+    std::condition_variable     cond_var_;
+};
+
+using ConflatedFeed = ConflatingQueue<std::string, lazy_json>;
+
+inline void print_queue_stats(std::ostream& os, const char* name, const queue_stats& s) {
+    if (s.conflating) {
+        os << name << ": pending=" << s.size << " keys=" << s.capacity << " high_water=" << s.high_water
+           << " pushes=" << s.pushes << " pops=" << s.pops << " conflated=" << s.drops << "\n";
+        return;
+    }
+    os << name << ": size=" << s.size << " capacity=" << (s.capacity ? std::to_string(s.capacity) : "unbounded")
+       << " high_water=" << s.high_water << " pushes=" << s.pushes << " pops=" << s.pops
+       << " drops=" << s.drops << " overflows=" << s.overflows << " policy=" << to_string(s.policy)
+       << " lock_wait=" << s.lock_wait_ns / 1000 << "us producer_wait=" << s.producer_wait_ns / 1000
+       << "us consumer_wait=" << s.consumer_wait_ns / 1000 << "us\n";
+}
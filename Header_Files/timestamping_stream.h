@@ -0,0 +1,197 @@
+#pragma once
+#include "common.h"
+
+#include <array>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <sys/socket.h>
+#endif
+
+// Stream layer between the TLS stream and the TCP socket that reads with recvmsg
+// and keeps the kernel receive timestamps (SO_TIMESTAMPING) of the most recent
+// read. Software timestamps come from the kernel's receive path; hardware ones
+// only appear when the NIC timestamps received packets (enabled with
+// SIOCSHWTSTAMP, e.g. by hwstamp_ctl or ptp4l) and are in the NIC clock, which
+// only compares with the system clock when phc2sys keeps them in step.
+//
+// With timestamping off, reads go straight to the tcp_stream. With it on, reads
+// bypass the tcp_stream timeouts, so it is enabled only once the TCP connection is
+// up. Linux only; elsewhere enable() reports operation_not_supported.
+enum class rx_timestamping { off, software, hardware };
+
+inline rx_timestamping parse_rx_timestamping(const std::string& name) {
+    if (name == "off") return rx_timestamping::off;
+    if (name == "software") return rx_timestamping::software;
+    if (name == "hardware") return rx_timestamping::hardware;
+    throw std::invalid_argument("Invalid timestamping mode '" + name + "'. Must be 'off', 'software' or 'hardware'.");
+}
+
+// Wall-clock nanoseconds since the epoch; 0 when not available.
+struct rx_timestamp {
+    std::int64_t hardware_ns = 0;   // NIC received the packet
+    std::int64_t software_ns = 0;   // kernel received the packet
+    std::int64_t user_ns = 0;       // recvmsg returned the bytes
+};
+
+class timestamping_stream {
+public:
+    using next_layer_type = beast::tcp_stream;
+    using executor_type = next_layer_type::executor_type;
+    // asio::ssl::stream needs these
+    using lowest_layer_type = tcp::socket;
+
+    template<class... Args>
+    explicit timestamping_stream(Args&&... args)
+        : next_(std::forward<Args>(args)...)
+    {
+    }
+
+    executor_type get_executor() noexcept { return next_.get_executor(); }
+    next_layer_type& next_layer() noexcept { return next_; }
+    const next_layer_type& next_layer() const noexcept { return next_; }
+    lowest_layer_type& lowest_layer() noexcept { return next_.socket(); }
+    const lowest_layer_type& lowest_layer() const noexcept { return next_.socket(); }
+
+    rx_timestamping mode() const { return mode_; }
+
+    // Timestamps of the read that returned the most recent bytes.
+    const rx_timestamp& last() const { return last_; }
+
+    // Turns timestamping on for the connected socket.
+    void enable(rx_timestamping mode, beast::error_code& ec) {
+        ec = {};
+        if (mode == rx_timestamping::off) {
+            mode_ = mode;
+            return;
+        }
+#ifdef __linux__
+        int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        if (mode == rx_timestamping::hardware) {
+            flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+        }
+        if (::setsockopt(next_.socket().native_handle(), SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0) {
+            ec.assign(errno, boost::system::system_category());
+            return;
+        }
+        mode_ = mode;
+#else
+        ec = net::error::operation_not_supported;
+#endif
+    }
+
+    template<class MutableBufferSequence, class ReadHandler>
+    auto async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler) {
+        return net::async_compose<ReadHandler, void(beast::error_code, std::size_t)>(
+            read_op<MutableBufferSequence>{*this, buffers}, handler, next_);
+    }
+
+    template<class ConstBufferSequence, class WriteHandler>
+    auto async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler) {
+        return next_.async_write_some(buffers, std::forward<WriteHandler>(handler));
+    }
+
+private:
+    template<class MutableBufferSequence>
+    struct read_op {
+        timestamping_stream& stream;
+        MutableBufferSequence buffers;
+        enum { starting, waiting, forwarded } state = starting;
+
+        template<class Self>
+        void operator()(Self& self, beast::error_code ec = {}, std::size_t n = 0) {
+            switch (state) {
+            case starting:
+                if (stream.mode_ == rx_timestamping::off) {
+                    state = forwarded;
+                    return stream.next_.async_read_some(buffers, std::move(self));
+                }
+                state = waiting;
+                return stream.next_.socket().async_wait(tcp::socket::wait_read, std::move(self));
+            case waiting:
+                if (ec) {
+                    return self.complete(ec, 0);
+                }
+                n = stream.receive(buffers, ec);
+                if (ec == net::error::would_block) {
+                    return stream.next_.socket().async_wait(tcp::socket::wait_read, std::move(self));
+                }
+                return self.complete(ec, n);
+            case forwarded:
+                return self.complete(ec, n);
+            }
+        }
+    };
+
+    template<class MutableBufferSequence>
+    std::size_t receive(const MutableBufferSequence& buffers, beast::error_code& ec) {
+#ifdef __linux__
+        std::array<iovec, 16> iov;
+        std::size_t count = 0;
+        std::size_t total = 0;
+        for (auto it = net::buffer_sequence_begin(buffers); it != net::buffer_sequence_end(buffers) && count < iov.size(); ++it) {
+            net::mutable_buffer b(*it);
+            if (b.size() == 0) {
+                continue;
+            }
+            iov[count].iov_base = b.data();
+            iov[count].iov_len = b.size();
+            total += b.size();
+            ++count;
+        }
+        if (total == 0) {
+            return 0;
+        }
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(scm_timestamping))];
+        msghdr msg{};
+        msg.msg_iov = iov.data();
+        msg.msg_iovlen = count;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = ::recvmsg(next_.socket().native_handle(), &msg, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                ec = net::error::would_block;
+            }else{
+                ec.assign(errno, boost::system::system_category());
+            }
+            return 0;
+        }
+        if (n == 0) {
+            ec = net::error::eof;
+            return 0;
+        }
+
+        rx_timestamp ts;
+        timespec now;
+        ::clock_gettime(CLOCK_REALTIME, &now);
+        ts.user_ns = to_ns(now);
+        for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+                scm_timestamping stamps;
+                std::memcpy(&stamps, CMSG_DATA(c), sizeof(stamps));
+                ts.software_ns = to_ns(stamps.ts[0]);
+                ts.hardware_ns = to_ns(stamps.ts[2]);
+            }
+        }
+        last_ = ts;
+        return static_cast<std::size_t>(n);
+#else
+        boost::ignore_unused(buffers);
+        ec = net::error::operation_not_supported;
+        return 0;
+#endif
+    }
+
+    static std::int64_t to_ns(const timespec& t) {
+        return static_cast<std::int64_t>(t.tv_sec) * 1000000000 + t.tv_nsec;
+    }
+
+    next_layer_type next_;
+    rx_timestamping mode_ = rx_timestamping::off;
+    rx_timestamp last_;
+};
@@ -0,0 +1,250 @@
+#pragma once
+#include "common.h"
+#include "json_rpc.h"
+#include "tsc_clock.h"
+
+#include <atomic>
+#include <cstring>
+#include <string_view>
+
+// Event tracing for following one request across threads: the CLI thread that
+// submits it, the strand post, the websocket write and the ack in on_read. Each
+// thread records into its own fixed-size ring (the oldest events are overwritten),
+// so recording takes no lock and never allocates after the ring exists: an
+// enabled check, one TSC read and a copy of the tag. dump() writes every ring as
+// Chrome trace JSON, which chrome://tracing and ui.perfetto.dev open.
+//
+// Events: complete spans (X), instants (i) and async begin/end pairs (b/e) keyed
+// by request id, which draw one bar per request across threads.
+namespace trace {
+
+// Request id and instrument attached to an event; truncated to fit.
+struct tag {
+    char request_id[40] = {};
+    char instrument[32] = {};
+
+    static tag make(std::string_view request_id, std::string_view instrument = {}) {
+        tag t;
+        copy(t.request_id, request_id);
+        copy(t.instrument, instrument);
+        return t;
+    }
+
+    bool empty() const { return request_id[0] == '\0'; }
+
+private:
+    template<std::size_t N>
+    static void copy(char (&dst)[N], std::string_view src) {
+        std::size_t n = std::min(src.size(), N - 1);
+        std::memcpy(dst, src.data(), n);
+        dst[n] = '\0';
+    }
+};
+
+// Tag of an outgoing RPC request; the instrument defaults to params.instrument_name.
+inline tag tag_of(const json& request, std::string_view instrument = {}) {
+    auto id_it = request.find("id");
+    if (id_it == request.end() || !id_it->is_string()) {
+        return {};
+    }
+    if (instrument.empty()) {
+        auto params_it = request.find("params");
+        if (params_it != request.end() && params_it->is_object()) {
+            auto name_it = params_it->find("instrument_name");
+            if (name_it != params_it->end() && name_it->is_string()) {
+                instrument = name_it->get_ref<const std::string&>();
+            }
+        }
+    }
+    return tag::make(id_it->get_ref<const std::string&>(), instrument);
+}
+
+struct event {
+    std::atomic<std::uint64_t> seq{0};   // 2n+1 while slot n is written, 2n+2 once done
+    tsc_clock::ticks start = 0;
+    tsc_clock::ticks end = 0;
+    const char* name = nullptr;          // string literal
+    char phase = 0;
+    tag tags;
+};
+
+class ring {
+public:
+    static constexpr std::size_t capacity = 8192;   // power of two
+
+    ring(std::uint32_t tid, std::string name)
+        : tid_(tid)
+        , name_(std::move(name))
+        , events_(capacity)
+    {
+    }
+
+    // Owner thread only.
+    void push(char phase, const char* name, tsc_clock::ticks start, tsc_clock::ticks end, const tag& t) {
+        std::uint64_t n = head_.load(std::memory_order_relaxed);
+        event& e = events_[n & (capacity - 1)];
+        e.seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        e.start = start;
+        e.end = end;
+        e.name = name;
+        e.phase = phase;
+        e.tags = t;
+        e.seq.store(2 * n + 2, std::memory_order_release);
+        head_.store(n + 1, std::memory_order_release);
+    }
+
+    void set_name(std::string name) {
+        std::lock_guard<std::mutex> lock(name_mtx_);
+        name_ = std::move(name);
+    }
+
+    std::string name() const {
+        std::lock_guard<std::mutex> lock(name_mtx_);
+        return name_;
+    }
+
+    std::uint32_t tid() const { return tid_; }
+
+    // Any thread. Skips slots overwritten while they are copied.
+    template<class F>
+    void for_each(F&& f) const {
+        std::uint64_t head = head_.load(std::memory_order_acquire);
+        std::uint64_t first = head > capacity ? head - capacity : 0;
+        for (std::uint64_t n = first; n < head; ++n) {
+            const event& e = events_[n & (capacity - 1)];
+            if (e.seq.load(std::memory_order_acquire) != 2 * n + 2) {
+                continue;
+            }
+            tsc_clock::ticks start = e.start;
+            tsc_clock::ticks end = e.end;
+            const char* name = e.name;
+            char phase = e.phase;
+            tag t = e.tags;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (e.seq.load(std::memory_order_relaxed) != 2 * n + 2) {
+                continue;
+            }
+            f(phase, name, start, end, t);
+        }
+    }
+
+private:
+    const std::uint32_t tid_;
+    mutable std::mutex name_mtx_;
+    std::string name_;
+    std::vector<event> events_;
+    std::atomic<std::uint64_t> head_{0};
+};
+
+// Rings outlive their threads so a dump still shows finished work.
+class registry {
+public:
+    static registry& instance() {
+        static registry r;
+        return r;
+    }
+
+    ring* attach() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto id = static_cast<std::uint32_t>(rings_.size() + 1);
+        rings_.push_back(std::make_shared<ring>(id, "thread " + std::to_string(id)));
+        return rings_.back().get();
+    }
+
+    std::vector<std::shared_ptr<ring>> rings() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return rings_;
+    }
+
+private:
+    mutable std::mutex mtx_;
+    std::vector<std::shared_ptr<ring>> rings_;
+};
+
+// Hot-path state kept out of function-local statics, which add a guard check.
+inline std::atomic<bool> enabled_flag{true};
+inline thread_local ring* local_ring = nullptr;
+
+inline ring& local() {
+    if (!local_ring) {
+        local_ring = registry::instance().attach();
+    }
+    return *local_ring;
+}
+
+inline bool enabled() {
+    return enabled_flag.load(std::memory_order_relaxed);
+}
+
+inline void set_enabled(bool on) {
+    enabled_flag.store(on, std::memory_order_relaxed);
+}
+
+// Names the calling thread's track in the dump.
+inline void set_thread_name(std::string name) {
+    local().set_name(std::move(name));
+}
+
+inline void instant(const char* name, const tag& t = {}) {
+    if (enabled()) {
+        tsc_clock::ticks now = tsc_clock::now();
+        local().push('i', name, now, now, t);
+    }
+}
+
+// A span whose start was taken earlier on any thread, recorded on this one.
+inline void complete(const char* name, tsc_clock::ticks start, const tag& t = {}) {
+    if (enabled()) {
+        local().push('X', name, start, tsc_clock::now(), t);
+    }
+}
+
+// Start and end of a request's journey; t.request_id pairs them.
+inline void async_begin(const char* name, const tag& t) {
+    if (enabled()) {
+        tsc_clock::ticks now = tsc_clock::now();
+        local().push('b', name, now, now, t);
+    }
+}
+
+inline void async_end(const char* name, const tag& t) {
+    if (enabled()) {
+        tsc_clock::ticks now = tsc_clock::now();
+        local().push('e', name, now, now, t);
+    }
+}
+
+// Writes every ring as Chrome trace JSON; returns the number of events.
+inline std::size_t dump(std::ostream& os) {
+    json events = json::array();
+    for (const auto& r : registry::instance().rings()) {
+        events.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 1}, {"tid", r->tid()},
+                          {"args", {{"name", r->name()}}}});
+        r->for_each([&](char phase, const char* name, tsc_clock::ticks start, tsc_clock::ticks end, const tag& t) {
+            json e = {
+                {"name", name},
+                {"ph", std::string(1, phase)},
+                {"ts", tsc_clock::to_steady_ns(start) / 1000.0},
+                {"pid", 1},
+                {"tid", r->tid()},
+            };
+            if (phase == 'X') {
+                e["dur"] = tsc_clock::to_ns(end > start ? end - start : 0) / 1000.0;
+            }else if (phase == 'i') {
+                e["s"] = "t";
+            }else{
+                e["cat"] = "request";
+                e["id"] = t.request_id;
+            }
+            if (!t.empty()) {
+                e["args"] = {{"request_id", t.request_id}, {"instrument", t.instrument}};
+            }
+            events.push_back(std::move(e));
+        });
+    }
+    os << json{{"traceEvents", events}, {"displayTimeUnit", "ns"}}.dump();
+    return events.size();
+}
+
+} // namespace trace
@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define OEMS_HAVE_TSC 1
+#endif
+
+// Timestamps for latency probes. With an invariant TSC (constant rate through
+// frequency and sleep state changes, CPUID 0x80000007 EDX bit 8) and RDTSCP, now()
+// is a single rdtscp of roughly 10 ns instead of a clock_gettime call. Probes keep
+// raw ticks; the stats and print paths turn them into nanoseconds with to_ns() or
+// elapsed().
+//
+// The tick rate is measured against steady_clock over a 2 ms spin during static
+// initialisation, then refined by recalibrate(), which the session heartbeat
+// timer calls; it measures over the whole time since startup, so the rate only
+// gets more precise. Without an invariant TSC (older CPUs, most VMs, non-x86)
+// now() falls back to steady_clock nanoseconds.
+class tsc_clock {
+public:
+    using ticks = std::uint64_t;
+
+    static ticks now() noexcept {
+#ifdef OEMS_HAVE_TSC
+        if (invariant_) {
+            unsigned int aux;
+            return __rdtscp(&aux);
+        }
+#endif
+        return steady_ns();
+    }
+
+    static bool invariant() noexcept { return invariant_; }
+
+    static double ns_per_tick() noexcept {
+        return ns_per_tick_.load(std::memory_order_relaxed);
+    }
+
+    static double to_ns(ticks delta) noexcept {
+        return static_cast<double>(delta) * ns_per_tick();
+    }
+
+    static std::chrono::nanoseconds elapsed(ticks from, ticks to) noexcept {
+        // an earlier tick read on another core may be a few ticks ahead
+        return std::chrono::nanoseconds(to > from ? static_cast<std::int64_t>(to_ns(to - from)) : 0);
+    }
+
+    static std::chrono::nanoseconds elapsed(ticks from) noexcept {
+        return elapsed(from, now());
+    }
+
+    // steady_clock nanoseconds at tick t.
+    static std::uint64_t to_steady_ns(ticks t) noexcept {
+        const calibration_anchor& a = anchor_;
+        return a.ns + static_cast<std::uint64_t>(static_cast<double>(t - a.tsc) * ns_per_tick());
+    }
+
+    // Re-measures the rate over the time since startup. Cheap; any thread.
+    static void recalibrate() noexcept {
+        if (!invariant_) {
+            return;
+        }
+        const calibration_anchor& a = anchor_;
+        std::uint64_t ns = steady_ns();
+        ticks t = now();
+        if (t > a.tsc && ns > a.ns) {
+            ns_per_tick_.store(static_cast<double>(ns - a.ns) / static_cast<double>(t - a.tsc), std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct calibration_anchor {
+        ticks tsc;
+        std::uint64_t ns;
+    };
+
+    static std::uint64_t steady_ns() noexcept {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    static bool detect_invariant() noexcept {
+#ifdef OEMS_HAVE_TSC
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 27))) {
+            return false;   // no RDTSCP
+        }
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+            return false;
+        }
+        return (edx & (1u << 8)) != 0;
+#else
+        return false;
+#endif
+    }
+
+    static calibration_anchor take_anchor() noexcept {
+        // tick and steady reads taken back to back; in fallback mode they are the same clock
+        std::uint64_t ns = steady_ns();
+        return {invariant_ ? now() : ns, ns};
+    }
+
+    // Startup estimate over a short spin; recalibrate() replaces it.
+    static double initial_rate() noexcept {
+        if (!invariant_) {
+            return 1.0;
+        }
+        const calibration_anchor& a = anchor_;
+        std::uint64_t ns;
+        ticks t;
+        do {
+            ns = steady_ns();
+            t = now();
+        } while (ns - a.ns < 2000000);
+        return static_cast<double>(ns - a.ns) / static_cast<double>(t - a.tsc);
+    }
+
+    // initialised in declaration order
+    inline static const bool invariant_ = detect_invariant();
+    inline static const calibration_anchor anchor_ = take_anchor();
+    inline static std::atomic<double> ns_per_tick_{initial_rate()};
+};
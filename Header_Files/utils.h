@@ -3,111 +3,308 @@
 
 #include "common.h"
 #include "json_rpc.h"
+#include "fixed_point.h"
+#include "instruments.h"
+#include "command_parser.h"
 
 namespace po = boost::program_options;
 
-void validate_place_order(const po::variables_map& vm) {
-    if (!vm.count("direction") || (vm["direction"].as<std::string>() != "buy" && vm["direction"].as<std::string>() != "sell")) {
+// Throws unless value lies exactly on the instrument's tick grid.
+inline void require_on_tick(const instrument_scale& scale, double value, const char* name) {
+    Price p;
+    if (!scale.to_price(value, rounding::exact, p)) {
+        throw std::invalid_argument(std::string("Invalid '") + name + "'. Must be a multiple of the tick size " + scale.tick_string() + ".");
+    }
+}
+
+// Throws unless value is a whole number of the instrument's lots.
+inline void require_on_lot(const instrument_scale& scale, double value, const char* name) {
+    Qty q;
+    if (!scale.to_qty(value, rounding::exact, q) || q.units() <= 0) {
+        throw std::invalid_argument(std::string("Invalid '") + name + "'. Must be a positive multiple of " + scale.lot_string() + ".");
+    }
+}
+
+// Throws unless the instrument is listed by the exchange. Accepts any name while the
+// registry is still empty (no cache and no refresh yet).
+inline void require_known_instrument(const InstrumentRegistry& instruments, const std::string& name) {
+    if (instruments.empty()) {
+        return;
+    }
+    auto info = instruments.get(name);
+    if (!info) {
+        throw std::invalid_argument("Unknown instrument '" + name + "'.");
+    }
+    if (!info->active) {
+        throw std::invalid_argument("Instrument '" + name + "' is no longer active.");
+    }
+}
+
+inline void validate_place_order(const command_line& cmd, const InstrumentRegistry& instruments) {
+    if (!cmd.has(option::direction) || (cmd.text(option::direction) != "buy" && cmd.text(option::direction) != "sell")) {
         throw std::invalid_argument("Invalid or missing 'direction'. Must be 'buy' or 'sell'.");
     }
 
-    if (!vm.count("instrument_name") || vm["instrument_name"].as<std::vector<std::string>>().empty()) {
+    if (!cmd.has(option::instrument_name) || cmd.list(option::instrument_name).empty()) {
         throw std::invalid_argument("Missing 'instrument_name'.");
     }
-    if(vm["instrument_name"].as<std::vector<std::string>>().size() > 1){
+    if(cmd.list(option::instrument_name).size() > 1){
         throw std::invalid_argument("Only one 'instrument_name' is allowed for the 'place' command.");
     }
 
-    std::string order_type = "limit";
-    if (vm.count("type")) {
-        order_type = vm["type"].as<std::string>();
-    }
+    std::string_view order_type = cmd.text(option::type, "limit");
 
-    bool has_amount = vm.count("amount");
-    bool has_contracts = vm.count("contracts");
+    bool has_amount = cmd.has(option::amount);
+    bool has_contracts = cmd.has(option::contracts);
 
     if (!has_amount && !has_contracts) {
         throw std::invalid_argument("At least one of 'amount' or 'contracts' must be provided.");
     }
 
     if (has_amount && has_contracts) {
-        double amount = vm["amount"].as<double>();
-        double contracts = vm["contracts"].as<double>();
+        double amount = cmd.number(option::amount);
+        double contracts = cmd.number(option::contracts);
         if (amount != contracts) {
             throw std::invalid_argument("'amount' and 'contracts' must match if both are provided.");
         }
     }
 
+    const std::string instrument_name(cmd.list(option::instrument_name)[0]);
+    require_known_instrument(instruments, instrument_name);
+    const instrument_scale scale = instruments.ticks().lookup(instrument_name);
+    if (has_amount) {
+        require_on_lot(scale, cmd.number(option::amount), "amount");
+    }
+
     if (order_type == "limit" || order_type == "stop_limit") {
-        if (!vm.count("price") || vm["price"].as<double>() <= 0) {
+        if (!cmd.has(option::price) || cmd.number(option::price) <= 0) {
             throw std::invalid_argument("Missing or invalid 'price'. Must be a positive number.");
         }
+        require_on_tick(scale, cmd.number(option::price), "price");
     }
 
     if (order_type == "stop_limit" || order_type == "stop_market" || order_type == "market") {
-        if (order_type != "market" && (!vm.count("trigger_price") || vm["trigger_price"].as<double>() <= 0 || ((vm["trigger_price"].as<double>() * 10) -(int)(vm["trigger_price"].as<double>() * 10) != 0 ))) {
-            throw std::invalid_argument("Missing or invalid 'trigger_price'. Must be a positive number with tick size 0.1.");
+        if (order_type != "market" && (!cmd.has(option::trigger_price) || cmd.number(option::trigger_price) <= 0)) {
+            throw std::invalid_argument("Missing or invalid 'trigger_price'. Must be a positive number.");
+        }
+        if (order_type != "market") {
+            require_on_tick(scale, cmd.number(option::trigger_price), "trigger_price");
         }
 
         if (order_type == "stop_limit") {
-            if (!vm.count("trigger") || (vm["trigger"].as<std::string>() != "index_price" && 
-                                          vm["trigger"].as<std::string>() != "mark_price" && 
-                                          vm["trigger"].as<std::string>() != "last_price")) {
+            if (!cmd.has(option::trigger) || (cmd.text(option::trigger) != "index_price" && 
+                                          cmd.text(option::trigger) != "mark_price" && 
+                                          cmd.text(option::trigger) != "last_price")) {
                 throw std::invalid_argument("Invalid or missing 'trigger'. Must be one of 'index_price', 'mark_price', or 'last_price'.");
             }
         }
     }
 
-    if (vm.count("label") && vm["label"].as<std::string>().size() > 64) {
+    if (cmd.has(option::label) && cmd.text(option::label).size() > 64) {
         throw std::invalid_argument("'label' must not exceed 64 characters.");
     }
 }
 
 
-jsonrpc store_required_values(const po::variables_map& vm){
+inline jsonrpc store_required_values(const command_line& cmd){
     jsonrpc j;
     
-    if (vm.count("direction")) {
-        j["method"] = "private/" + vm["direction"].as<std::string>();
+    if (cmd.has(option::direction)) {
+        j["method"] = "private/" + cmd.str(option::direction);
     }
     
     j["params"] = json::object();
 
-    if (vm.count("instrument_name")) {
-        j["params"].push_back({"instrument_name", vm["instrument_name"].as<std::vector<std::string>>()[0]});
+    if (cmd.has(option::instrument_name)) {
+        j["params"].push_back({"instrument_name", cmd.list(option::instrument_name)[0]});
     }
 
-    if (vm.count("type")) {
-        j["params"].push_back({"type", vm["type"].as<std::string>()});
+    if (cmd.has(option::type)) {
+        j["params"].push_back({"type", cmd.str(option::type)});
     } else {
         j["params"].push_back({"type", "limit"});
     }
 
-    if (vm.count("amount")) {
-        j["params"].push_back({"amount", vm["amount"].as<double>()});
+    if (cmd.has(option::amount)) {
+        j["params"].push_back({"amount", cmd.number(option::amount)});
+    }
+
+    if (cmd.has(option::contracts)) {
+        j["params"].push_back({"contracts", cmd.number(option::contracts)});
+    }
+
+    if (cmd.has(option::price)) {
+        j["params"].push_back({"price", cmd.number(option::price)});
+    }
+
+    if (cmd.has(option::trigger_price)) {
+        j["params"].push_back({"trigger_price", cmd.number(option::trigger_price)});
+    }
+
+    if (cmd.has(option::trigger)) {
+        j["params"].push_back({"trigger", cmd.str(option::trigger)});
+    }
+
+    return j;
+}
+
+// scale is the tick/lot table of the order's instrument when it is known to the session.
+inline void validate_edit_order(const command_line& cmd, const instrument_scale& scale) {
+    if (!cmd.has(option::order_id) || cmd.text(option::order_id).empty()) {
+        throw std::invalid_argument("Missing 'order_id'.");
+    }
+
+    bool has_amount = cmd.has(option::amount);
+    bool has_contracts = cmd.has(option::contracts);
+
+    if (!has_amount && !has_contracts) {
+        throw std::invalid_argument("At least one of 'amount' or 'contracts' must be provided.");
     }
 
-    if (vm.count("contracts")) {
-        j["params"].push_back({"contracts", vm["contracts"].as<double>()});
+    if (has_amount && has_contracts && cmd.number(option::amount) != cmd.number(option::contracts)) {
+        throw std::invalid_argument("'amount' and 'contracts' must match if both are provided.");
     }
 
-    if (vm.count("price")) {
-        j["params"].push_back({"price", vm["price"].as<double>()});
+    if ((has_amount && cmd.number(option::amount) <= 0) || (has_contracts && cmd.number(option::contracts) <= 0)) {
+        throw std::invalid_argument("Invalid 'amount'. Must be a positive number.");
+    }
+    if (has_amount) {
+        require_on_lot(scale, cmd.number(option::amount), "amount");
     }
 
-    if (vm.count("trigger_price")) {
-        j["params"].push_back({"trigger_price", vm["trigger_price"].as<double>()});
+    if (cmd.has(option::price)) {
+        if (cmd.number(option::price) <= 0) {
+            throw std::invalid_argument("Invalid 'price'. Must be a positive number.");
+        }
+        require_on_tick(scale, cmd.number(option::price), "price");
     }
 
-    if (vm.count("trigger")) {
-        j["params"].push_back({"trigger", vm["trigger"].as<std::string>()});
+    if (cmd.has(option::trigger_price)) {
+        if (cmd.number(option::trigger_price) <= 0) {
+            throw std::invalid_argument("Invalid 'trigger_price'. Must be a positive number.");
+        }
+        require_on_tick(scale, cmd.number(option::trigger_price), "trigger_price");
     }
+}
 
+// Builds a private/edit request amending price and amount of a resting order in one message,
+// so the order keeps its queue priority where the exchange allows it.
+inline jsonrpc make_edit_request(const std::string& order_id, double amount, std::optional<double> price = std::nullopt) {
+    jsonrpc j("private/edit");
+    j["params"] = {
+        {"order_id", order_id},
+        {"amount", amount},
+    };
+    if (price) {
+        j["params"]["price"] = *price;
+    }
+    return j;
+}
+
+inline jsonrpc store_edit_values(const command_line& cmd) {
+    double amount = cmd.has(option::amount) ? cmd.number(option::amount) : cmd.number(option::contracts);
+    std::optional<double> price;
+    if (cmd.has(option::price)) {
+        price = cmd.number(option::price);
+    }
+
+    jsonrpc j = make_edit_request(cmd.str(option::order_id), amount, price);
+
+    if (cmd.has(option::contracts)) {
+        j["params"]["contracts"] = cmd.number(option::contracts);
+    }
+
+    if (cmd.has(option::trigger_price)) {
+        j["params"]["trigger_price"] = cmd.number(option::trigger_price);
+    }
+
+    if (cmd.has(option::trigger_offset)) {
+        j["params"]["trigger_offset"] = cmd.number(option::trigger_offset);
+    }
+
+    if (cmd.has(option::post_only)) {
+        j["params"]["post_only"] = cmd.boolean(option::post_only);
+    }
+
+    if (cmd.has(option::reject_post_only)) {
+        j["params"]["reject_post_only"] = cmd.boolean(option::reject_post_only);
+    }
+
+    if (cmd.has(option::mmp)) {
+        j["params"]["mmp"] = cmd.boolean(option::mmp);
+    }
+
+    if (cmd.has(option::valid_until)) {
+        j["params"]["valid_until"] = cmd.integer(option::valid_until);
+    }
+
+    return j;
+}
+
+inline jsonrpc make_cancel_request(const command_line& cmd) {
+    if (!cmd.has(option::order_id)) {
+        throw std::invalid_argument("Missing required parameter for cancel: --order_id.");
+    }
+    jsonrpc j("/private/cancel");
+    j["params"] = {
+        {"order_id", cmd.str(option::order_id)},
+    };
+    return j;
+}
+
+inline jsonrpc make_order_book_request(const command_line& cmd, const InstrumentRegistry& instruments) {
+    static const std::unordered_set<int> valid_depths = {1,5,10,20,50,100,1000,10000};
+    if (!cmd.has(option::instrument_name) || cmd.list(option::instrument_name).empty() || !cmd.has(option::depth)) {
+        throw std::invalid_argument("Missing required parameters for get_order_book: --instrument_name and --depth.");
+    }
+    if (cmd.list(option::instrument_name).size() > 1) {
+        throw std::invalid_argument("Only one 'instrument_name' is allowed for the 'get_order_book' command.");
+    }
+    if (valid_depths.find(cmd.integer(option::depth)) == valid_depths.end()) {
+        throw std::invalid_argument("Depth has an invalid value. valid depths are {1,5,10,20,50,100,1000,10000}");
+    }
+    const std::string name(cmd.list(option::instrument_name)[0]);
+    require_known_instrument(instruments, name);
+
+    jsonrpc j("public/get_order_book");
+    j["params"] = {
+        {"instrument_name", name},
+        {"depth", cmd.integer(option::depth)},
+    };
+    return j;
+}
+
+// private/subscribe or private/unsubscribe for each --channel/--instrument_name pair.
+inline jsonrpc make_channels_request(const std::string& method, const command_line& cmd) {
+    if (!cmd.has(option::instrument_name) || !cmd.has(option::channel)) {
+        throw std::invalid_argument("Missing required parameters for subscribe: --instrument_name and --channel.");
+    }
+
+    const auto& channels = cmd.list(option::channel);
+    const auto& instrument_names = cmd.list(option::instrument_name);
+
+    // Validate that the counts match
+    if (channels.size() != instrument_names.size()) {
+        throw std::invalid_argument("The number of --channel and --instrument_name arguments must match.");
+    }
+
+    std::vector<std::string> subscription_channels;
+    for (size_t i = 0; i < channels.size(); ++i) {
+        std::string channel(channels[i]);
+        channel += '.';
+        channel += instrument_names[i];
+        subscription_channels.push_back(std::move(channel));
+    }
+
+    jsonrpc j(method);
+    j["params"] = {
+        {"channels", subscription_channels}
+    };
     return j;
 }
 
 //configures help message options
-po::options_description configure_help_options() {
+inline po::options_description configure_help_options() {
     po::options_description desc("Available commands");
     desc.add_options()
         ("help,h", "Produce help message")
@@ -126,7 +323,7 @@ po::options_description configure_help_options() {
          "            (Required for 'limit' and 'stop_limit').\n"
          "   --trigger_price <positive double>\n"
          "      (Required for 'stop_limit' and 'stop_market').\n"
-         "                                     Tick size: 0.1.\n"
+         "        Prices must be on the instrument's tick size.\n"
          "   --trigger <index_price|mark_price|last_price>\n"
          "                        (Required for 'stop_limit').\n"
          "   --label <string> \n"
@@ -139,6 +336,79 @@ po::options_description configure_help_options() {
          "      --trigger_offset <positive double> \n")
         ("cancel", "Cancel an order. Required parameters:\n"
          "   --order_id <string>")
+        ("edit",
+         "Amend price and amount of an open order in one message. Parameters:\n"
+         "   --order_id <string>                   (Required).\n"
+         "   --amount <positive double>(Atleast one).\n"
+         "   --contracts <positive double>(Atleast one).\n"
+         "   --price <positive double>             (Optional).\n"
+         "   --trigger_price <positive double>     (Optional).\n"
+         "   Additional options: \n"
+         "      --post_only <bool>                 .\n"
+         "      --reject_post_only <bool>          .\n"
+         "      --mmp <bool>                       .\n"
+         "      --valid_until <int>                \n"
+         "      --trigger_offset <positive double> \n")
+        ("orders", "List orders tracked in this session")
+        ("feed", "Drain the subscription queues: latest value per conflated channel\n"
+         "   (ticker.*, deribit_price_index.*) with its conflated update count,\n"
+         "   and the number of queued notifications on other channels.")
+        ("session_stats", "Show handler allocation counters of the read/write loops and,\n"
+         "   with --timestamping, the receive path stages of each frame")
+        ("heartbeat", "Show liveness of the connection: ping round trips, time since the\n"
+         "   last inbound frame and exchange heartbeats. Optional parameters\n"
+         "   (applied from the next connection):\n"
+         "   --ping_interval <int>      milliseconds between pings (default 1000)\n"
+         "   --liveness_timeout <int>   milliseconds without inbound traffic before\n"
+         "                              the link is treated as half-open and\n"
+         "                              reconnected (default 5000)")
+        ("clock", "Show the exchange clock estimate from public/get_time samples\n"
+         "   (offset, drift, best RTT) and the exchange-to-client one-way delay\n"
+         "   of messages on the current connection.")
+        ("queue_stats", "Show queue health. Optional parameters:\n"
+         "   --watch <int>      refresh every second for n seconds")
+        ("queue_config", "Change queue bounds. Required parameters:\n"
+         "   --queue <inbox|feed>\n"
+         "   --capacity <int>   (0 = unbounded)\n"
+         "   --policy <block|drop_oldest|drop_newest|disconnect>")
+        ("rtt", "Measure request round trips over a dedicated coroutine session.\n"
+         "   --count <int>      number of sequential public/test calls (default 10)")
+        ("decode", "Select how frames are decoded for this and later sessions:\n"
+         "   heap  (default), arena (per-frame monotonic arena) or\n"
+         "   index (SIMD structural index; default when built with OEMS_JSON_INDEX) or\n"
+         "   lazy  (notifications queued raw, parsed by the consumer)")
+        ("timestamping", "Kernel receive timestamps (SO_TIMESTAMPING, Linux) on the socket\n"
+         "   of the next connection: off (default), software or hardware")
+        ("trace", "Request tracing across threads (on by default). Actions:\n"
+         "   on | off\n"
+         "   dump --path <file>   write the per-thread rings as Chrome trace JSON\n"
+         "                        (chrome://tracing, ui.perfetto.dev)")
+        ("metrics", "Prometheus metrics endpoint on 127.0.0.1. Actions:\n"
+         "   on [--port <int>]    serve GET /metrics (default port 9464)\n"
+         "   off                  stop serving\n"
+         "   show                 print the current metrics")
+        ("bench", "Run an offline benchmark. Parameters:\n"
+         "   decode             heap vs arena DOM decoding of a capture\n"
+         "   parse              command line parsing of a command file\n"
+         "   book               std::map vs price-ladder order book on book.* frames\n"
+         "   numbers            strtod/from_chars vs SIMD decimal parsing of a capture\n"
+         "   json               nlohmann parse vs structural index throughput (GB/s)\n"
+         "   classify           read-strand cost of json::parse vs lazy classification\n"
+         "   --path <prefix|file> (Required).")
+        ("record", "Capture raw websocket frames to segment files. Required parameters:\n"
+         "   --path <prefix>   (files are named <prefix>.NNNNNN.seg)")
+        ("record_stop", "Stop capturing and print capture statistics")
+        ("replay", "Replay a capture through the frame decode and dispatch path. Parameters:\n"
+         "   --path <prefix>                       (Required).\n"
+         "   --speed <double>   0 = as fast as possible (default),\n"
+         "                      1 = real time, N = N times faster.\n"
+         "   Uses the mode selected with --decode.")
+        ("batch", "Send every command of a file ('-' for stdin) pipelined and report\n"
+         "   per-command latency. Supports place, cancel, edit, get_order_book,\n"
+         "   subscribe, unsubscribe and unsubscribe_all; all lines are validated\n"
+         "   before anything is sent. Requires authentication.")
+        ("instruments", "Show instrument metadata. Optional parameters:\n"
+         "   --instrument_name <string>")
         ("get_order_book", 
          "Get the order book for an instrument. Required parameters:\n"
          "   --instrument_name <string>\n"
@@ -156,8 +426,9 @@ po::options_description configure_help_options() {
 }
 
 
-// Configures all CLI options
-void configure_cmdline_options(po::options_description& desc) {
+// The prompt grammar expressed as boost::program_options options. The prompt and
+// batch files parse with command_line; this is kept as the baseline of --bench parse.
+inline void configure_cmdline_options(po::options_description& desc) {
     desc.add_options()
         ("help,h", "Display help message")
         ("connect", "Connect to the Deribit WebSocket API")
@@ -165,9 +436,30 @@ void configure_cmdline_options(po::options_description& desc) {
         ("exit", "Exit the program")
         ("place", "Place a new order")
         ("cancel", "Cancel an order")
+        ("edit", "Edit an open order")
+        ("orders", "List tracked orders")
+        ("feed", "Drain subscription queues")
+        ("rtt", "Measure request round trips")
+        ("count", po::value<int>()->default_value(10), "Number of requests")
+        ("queue_stats", "Show queue health")
+        ("session_stats", "Show session handler allocation counters")
+        ("queue_config", "Change queue capacity and overflow policy")
+        ("watch", po::value<int>(), "Refresh duration in seconds")
+        ("queue", po::value<std::string>(), "Queue name ('inbox' or 'feed')")
+        ("capacity", po::value<std::size_t>(), "Queue capacity (0 = unbounded)")
+        ("policy", po::value<std::string>(), "Overflow policy")
+        ("record", "Capture raw frames to segment files")
+        ("record_stop", "Stop capturing raw frames")
+        ("path", po::value<std::string>(), "File path or prefix")
+        ("replay", "Replay a capture")
+        ("decode", po::value<std::string>(), "Decode mode ('heap', 'arena', 'index' or 'lazy')")
+        ("bench", po::value<std::string>(), "Benchmark name")
+        ("speed", po::value<double>()->default_value(0), "Replay speed factor (0 = as fast as possible)")
+        ("batch", po::value<std::string>(), "Batch file ('-' for stdin)")
+        ("instruments", "Show instrument metadata")
         ("get_order_book", "Get the order book for an instrument")
         ("subscribe", "Subscribe to one or more channels")
-        ("order_id", po::value<std::string>(), "Order ID (required for cancel)")
+        ("order_id", po::value<std::string>(), "Order ID (required for cancel and edit)")
         ("channel", po::value<std::vector<std::string>>()->multitoken(), "Channel name(s) (for subscribe)")
         ("instrument_name", po::value<std::vector<std::string>>()->multitoken(), "Instrument name(s) (for subscribe)")
         ("depth", po::value<int>(), "Depth for order book")
@@ -176,7 +468,7 @@ void configure_cmdline_options(po::options_description& desc) {
         ("amount", po::value<double>(), "Order amount (positive number)")
         ("contracts", po::value<double>(), "Order contracts (positive number)")
         ("price", po::value<double>(), "Order price (positive number)")
-        ("trigger_price", po::value<double>(), "Trigger price (positive number with tick size 0.1)")
+        ("trigger_price", po::value<double>(), "Trigger price (positive number on the instrument tick size)")
         ("trigger", po::value<std::string>(), "Trigger type ('index_price', 'mark_price', 'last_price')")
         ("post_only", po::value<bool>(), "Post-only flag")
         ("reject_post_only", po::value<bool>(), "Reject post-only flag")
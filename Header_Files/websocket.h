@@ -1,43 +1,20 @@
 #pragma once
 #include "json_rpc.h"
 #include "common.h"
+#include "recorder.h"
+#include "thread_safe_queue.h"
+#include "dispatcher.h"
+#include "handler_alloc.h"
+#include "heartbeat.h"
+#include "timestamping_stream.h"
+#include "tsc_clock.h"
+#include "trace.h"
+#include "metrics.h"
 
-template <typename T> class ThreadSafeQueue {
-public:
-    void push(T const& value) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        queue_.push(value);
-        cond_var_.notify_one();
-    }
-
-    bool try_pop(T& value) {
-        std::lock_guard<std::mutex> lock(mtx_);
-        if (queue_.empty()) {
-            return false;
-        }
-        value = queue_.front();
-        queue_.pop();
-        return true;
-    }
-
-    void wait_and_pop(T& value) {
-        std::unique_lock<std::mutex> lock(mtx_);
-        cond_var_.wait(lock, [this] { return !queue_.empty(); });
-        value = queue_.front();
-        queue_.pop();
-    }
-
-private:
-    std::queue<T>           queue_;
-    mutable std::mutex      mtx_;
-    std::condition_variable cond_var_;
-};
-
-using RpcQueue = ThreadSafeQueue<json>;
 //------------------------------------------------------------------------------
 
 // Report a failure
-void
+inline void
 fail(beast::error_code ec, char const* what)
 {
     std::cerr << what << ": " << ec.message() << "\n";
@@ -51,32 +28,227 @@ class session : public std::enable_shared_from_this<session>
 private:
     net::io_context& ioc_;
     tcp::resolver resolver_;
-    websocket::stream<beast::ssl_stream<beast::tcp_stream>> ws_;
+    strand ws_strand_;
+    websocket::stream<beast::ssl_stream<timestamping_stream>> ws_;
     beast::flat_buffer buffer_;
     std::string host_;
     std::string endpoint_;
-    strand ws_strand_;
-    RpcQueue& inbox_;
-    RpcQueue& feedQueue_;
-    std::deque<std::string> outbox_;
-    std::string access_token_;
+    struct outbound {
+        std::string message;
+        trace::tag tag;
+    };
+    std::deque<outbound> outbox_;
+    // requests traced from send to ack, by id; strand only
+    std::unordered_map<std::string, trace::tag> traced_;
+    tsc_clock::ticks write_start_ = 0;
+    // recycled handler state for the steady-state read and write loops
+    handler_memory read_memory_;
+    handler_memory write_memory_;
+    // keeps the session alive while the read loop or writes are in flight, so the
+    // loop handlers only carry a raw pointer
+    std::shared_ptr<session> self_;
+    bool reading_ = false;
+    frame_dispatcher dispatcher_;
+    std::function<bool(session&, const json&)> response_handler_;
+    std::function<void(session&)> open_handler_;
+    std::function<void(session&, const std::string&)> failover_handler_;
+    std::shared_ptr<FrameRecorder> recorder_;
+    std::uint32_t connection_id_;
+    bool overflow_escalated_ = false;
+    bool verbose_ = true;
+    // liveness: exchange heartbeats, scheduled pings and their round-trip times
+    heartbeat_config heartbeat_;
+    net::steady_timer heartbeat_timer_;
+    latency_series ping_rtt_;
+    std::string ping_payload_;
+    tsc_clock::ticks ping_sent_ = 0;
+    std::uint64_t ping_seq_ = 0;
+    bool ping_in_flight_ = false;
+    bool failed_over_ = false;
+    std::atomic<bool> closing_{false};
+    std::atomic<tsc_clock::ticks> last_rx_{0};
+    std::atomic<std::uint64_t> exchange_heartbeats_{0};
+    std::atomic<std::uint64_t> test_requests_{0};
+    // public/get_time samples for the shared exchange clock estimate
+    std::shared_ptr<ClockSync> clock_;
+    std::unordered_map<std::uint64_t, std::int64_t> time_requests_;   // seq -> local send time
+    std::uint64_t time_seq_ = 0;
+    std::chrono::steady_clock::time_point last_time_request_;
+    std::int64_t frame_received_ns_ = 0;
+    // kernel receive timestamps and the receive path stages derived from them
+    rx_timestamping rx_timestamping_ = rx_timestamping::off;
+    std::int64_t last_linked_read_ns_ = 0;
+    latency_series wire_to_kernel_;
+    latency_series kernel_to_user_;
+    latency_series decrypt_;
+    latency_series parse_;
+    // counters and histograms exposed by the metrics endpoint
+    std::shared_ptr<metrics::connection_metrics> metrics_;
+
+    // Heartbeat traffic uses this id prefix so its responses never reach the
+    // application's response handler or the inbox.
+    static constexpr std::string_view heartbeat_id_prefix = "hb-";
+
+    static std::uint32_t next_connection_id() {
+        static std::atomic<std::uint32_t> counter{0};
+        return ++counter;
+    }
 
 public:
     // Resolver and socket require an io_context
     explicit
-    session(net::io_context& ioc, ssl::context& ctx, ThreadSafeQueue<json>& inbox, ThreadSafeQueue<json>& feedQueue)
-        : resolver_(net::make_strand(ioc)) // Looks up the domain name
-        , ws_(net::make_strand(ioc), ctx) // Websocket constructor takes an IO context and ssl context
-        , ioc_(ioc) // reference to the io_context created in the main function
-        , ws_strand_(ioc.get_executor()) // Get a strand from the io_context
-        , inbox_(inbox)
-        , feedQueue_(feedQueue)
+    session(net::io_context& ioc, ssl::context& ctx, RpcQueue& inbox, RpcQueue& feedQueue)
+        : ioc_(ioc) // reference to the io_context created in the main function
+        , resolver_(net::make_strand(ioc)) // Looks up the domain name
+        , ws_strand_(net::make_strand(ioc)) // Strand shared by the stream and all session handlers
+        , ws_(ws_strand_, ctx) // Websocket constructor takes an executor and ssl context
+        , dispatcher_(inbox, feedQueue)
+        , connection_id_(next_connection_id())
+        , heartbeat_timer_(ws_strand_)
+        , metrics_(std::make_shared<metrics::connection_metrics>())
     {
-
+        dispatcher_.set_response_handler([this](const json& j) {
+            if (!traced_.empty()) {
+                trace_ack(j);
+            }
+            if (has_error_code(j, too_many_requests)) {
+                metrics_->rate_limited.inc();
+            }
+            return on_heartbeat_response(j) || (response_handler_ && response_handler_(*this, j));
+        });
+        dispatcher_.set_heartbeat_handler([this](const json& j) {
+            on_exchange_heartbeat(j);
+        });
+        // escalation for queues configured with overflow_policy::disconnect
+        dispatcher_.set_overflow_handler([this](const char* queue) {
+            if (overflow_escalated_) {
+                return;
+            }
+            overflow_escalated_ = true;
+            std::cerr << "Queue '" << queue << "' overflowed, disconnecting.\n";
+            close_websocket();
+        });
     }
 
     std::string get_access_token() const {
-        return access_token_;
+        return dispatcher_.access_token();
+    }
+
+    // Called on the strand for every RPC response. Returning true consumes the response,
+    // otherwise it continues to the inbox. Must be set before run().
+    void set_response_handler(std::function<bool(session&, const json&)> handler) {
+        response_handler_ = std::move(handler);
+    }
+
+    // Called on the strand for every subscription notification. Returning true consumes
+    // it, otherwise it continues to the feed queues. Must be set before run().
+    void set_notification_handler(std::function<bool(const json&)> handler) {
+        dispatcher_.set_notification_handler(std::move(handler));
+    }
+
+    // Per-frame logging of received and sent messages. Must be set before run().
+    void set_verbose(bool verbose) {
+        verbose_ = verbose;
+        dispatcher_.set_verbose(verbose);
+    }
+
+    std::uint32_t connection_id() const {
+        return connection_id_;
+    }
+
+    // Starts (or with nullptr stops) capturing raw frames. Applied on the strand so
+    // on_read never races with the change.
+    void set_recorder(std::shared_ptr<FrameRecorder> recorder) {
+        net::post(ws_strand_, [self = shared_from_this(), r = std::move(recorder)]() mutable {
+            self->recorder_ = std::move(r);
+        });
+    }
+
+    // Sends channels matching prefixes to a last-value queue. Must be set before run().
+    void set_conflated_feed(ConflatedFeed& queue, std::vector<std::string> prefixes) {
+        dispatcher_.set_conflation(&queue, std::move(prefixes));
+    }
+
+    // Routes notifications on interned channels by id. Must be set before run().
+    void set_channel_registry(std::shared_ptr<const channel_registry> channels) {
+        dispatcher_.set_channel_registry(std::move(channels));
+    }
+
+    // Switches frame decoding between heap and arena DOMs. Applied on the strand.
+    void set_decode_mode(decode_mode mode) {
+        net::post(ws_strand_, [self = shared_from_this(), mode] {
+            self->dispatcher_.set_decode_mode(mode);
+        });
+    }
+
+    // Called on the strand once the websocket handshake completes. Must be set before run().
+    void set_open_handler(std::function<void(session&)> handler) {
+        open_handler_ = std::move(handler);
+    }
+
+    // Liveness settings for this connection. Must be set before run().
+    void set_heartbeat_config(const heartbeat_config& config) {
+        validate_heartbeat_config(config);
+        heartbeat_ = config;
+    }
+
+    // Called on the strand, at most once, when the connection is lost without
+    // close_websocket(): a read error or no inbound traffic for liveness_timeout.
+    // The socket is already closed; the handler decides whether to reconnect.
+    // Must be set before run().
+    void set_failover_handler(std::function<void(session&, const std::string& reason)> handler) {
+        failover_handler_ = std::move(handler);
+    }
+
+    // Samples the exchange clock through this connection and stamps inbound
+    // messages with their one-way delay. The clock may be shared by sessions.
+    // Must be set before run().
+    void set_clock_sync(std::shared_ptr<ClockSync> clock) {
+        clock_ = clock;
+        dispatcher_.set_clock_sync(std::move(clock));
+    }
+
+    // Exchange-to-client delay of stamped messages on this connection.
+    latency_summary get_one_way_delay() const {
+        return dispatcher_.one_way_delay();
+    }
+
+    // Kernel (and NIC) receive timestamps on the TCP socket, linked to the frames
+    // they complete. Must be set before run().
+    void set_rx_timestamping(rx_timestamping mode) {
+        rx_timestamping_ = mode;
+    }
+
+    // Receive path of a frame, split at the NIC, kernel, recvmsg and on_read
+    // timestamps: wire->kernel (hardware mode only), kernel->user, decrypt
+    // (TLS and WebSocket deframing up to on_read) and parse (decode and routing).
+    struct rx_stage_stats {
+        latency_summary wire_to_kernel;
+        latency_summary kernel_to_user;
+        latency_summary decrypt;
+        latency_summary parse;
+    };
+
+    rx_stage_stats get_rx_stage_stats() const {
+        return {wire_to_kernel_.summary(), kernel_to_user_.summary(), decrypt_.summary(), parse_.summary()};
+    }
+
+    struct liveness_stats {
+        latency_summary ping_rtt;
+        std::chrono::milliseconds since_last_rx;
+        std::uint64_t exchange_heartbeats;
+        std::uint64_t test_requests;
+    };
+
+    liveness_stats get_liveness_stats() const {
+        return {ping_rtt_.summary(),
+                std::chrono::duration_cast<std::chrono::milliseconds>(tsc_clock::elapsed(last_rx_.load())),
+                exchange_heartbeats_.load(), test_requests_.load()};
+    }
+
+    // Updated on the strand with relaxed atomics; read from any thread.
+    std::shared_ptr<const metrics::connection_metrics> get_metrics() const {
+        return metrics_;
     }
 
     // Start the asynchronous operation
@@ -134,6 +306,13 @@ public:
             return fail(ec, "connect");
 
         std::cout << "Connection established with endpoint: " << ep.address() << ":" << ep.port() << std::endl;
+        if (rx_timestamping_ != rx_timestamping::off) {
+            beast::error_code ts_ec;
+            ws_.next_layer().next_layer().enable(rx_timestamping_, ts_ec);
+            if (ts_ec) {
+                fail(ts_ec, "SO_TIMESTAMPING");
+            }
+        }
         std::cout << "Starting SSL handshake..." << std::endl;
         // Gets the socket associated with this web socket and sets a timeout on the operation.
         // ws_ is declared as websocket::stream<beast::ssl_stream<beast::tcp_stream>>
@@ -200,20 +379,102 @@ public:
             return fail(ec, "handshake");
 
         std::cout << "WebSocket Handshake successful. Connected to Deribit Test..." << std::endl;
-        // do read
+        // pongs (and pings) count as inbound traffic for the liveness check
+        ws_.control_callback([this](websocket::frame_type kind, beast::string_view payload) {
+            on_control(kind, payload);
+        });
+        mark_rx();
+        if (open_handler_) {
+            open_handler_(*this);
+        }
+        self_ = shared_from_this();
+        reading_ = true;
+        do_read();
+        start_heartbeat();
+    }
+
+    struct handler_stats {
+        std::uint64_t read_heap;
+        std::uint64_t read_reused;
+        std::uint64_t write_heap;
+        std::uint64_t write_reused;
+    };
+
+    // Heap allocations stop growing once the read/write loops are warmed up.
+    handler_stats get_handler_stats() const {
+        return {read_memory_.heap_allocations(), read_memory_.reused_allocations(),
+                write_memory_.heap_allocations(), write_memory_.reused_allocations()};
+    }
+
+    void do_read() {
         ws_.async_read(
             buffer_,
-            boost::asio::bind_executor(ws_strand_, beast::bind_front_handler( &session::on_read, shared_from_this())));
+            make_recycling_handler(ws_strand_, read_memory_, [this](beast::error_code ec, std::size_t n) {
+                on_read(ec, n);
+            }));
     }
 
-    void send_message(std::string& message){
-        net::post(ws_strand_,[this, m = std::move(message)] () mutable {
-            outbox_.push_back(std::move(m));
-            if (outbox_.size() == 1){
-                // do write
-                ws_.async_write(
-                net::buffer(outbox_.front()),
-                boost::asio::bind_executor(ws_strand_, beast::bind_front_handler( &session::on_write, shared_from_this())));
+    void do_write() {
+        if (!self_) {
+            self_ = shared_from_this();
+        }
+        write_start_ = tsc_clock::now();
+        ws_.async_write(
+            net::buffer(outbox_.front().message),
+            make_recycling_handler(ws_strand_, write_memory_, [this](beast::error_code ec, std::size_t n) {
+                on_write(ec, n);
+            }));
+    }
+
+    // Drops the self reference once neither loop has an operation outstanding.
+    // May destroy the session; callers must not touch members afterwards.
+    void release_if_idle() {
+        if (!reading_ && outbox_.empty()) {
+            auto last_ref = std::move(self_);
+        }
+    }
+
+    // Strand only.
+    void enqueue(std::string message, const trace::tag& tag = {}) {
+        if (!tag.empty()) {
+            trace::instant("strand.enqueue", tag);
+            traced_.emplace(tag.request_id, tag);
+        }
+        outbox_.push_back({std::move(message), tag});
+        if (outbox_.size() == 1){
+            do_write();
+        }
+    }
+
+    // A non-empty tag traces the request from here to its ack (see trace.h).
+    void send_message(std::string& message, const trace::tag& tag = {}){
+        if (!tag.empty()) {
+            trace::async_begin("rpc", tag);
+        }
+        net::post(ws_strand_,[this, m = std::move(message), tag] () mutable {
+            enqueue(std::move(m), tag);
+        });
+    }
+
+    // Queues pre-encoded messages with a single hop onto the strand; they are
+    // written back to back without waiting for responses. tags, if given, match
+    // messages one to one.
+    void send_batch(std::vector<std::string> messages, std::vector<trace::tag> tags = {}){
+        for (const auto& tag : tags) {
+            trace::async_begin("rpc", tag);
+        }
+        net::post(ws_strand_,[this, batch = std::move(messages), tags = std::move(tags)] () mutable {
+            bool idle = outbox_.empty();
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                const trace::tag& tag = i < tags.size() ? tags[i] : trace::tag{};
+                if (!tag.empty()) {
+                    trace::instant("strand.enqueue", tag);
+                    traced_.emplace(tag.request_id, tag);
+                }
+                outbox_.push_back({std::move(batch[i]), tag});
+            }
+            if (idle && !outbox_.empty()){
+                do_write();
             }
         });
     }
@@ -226,21 +487,26 @@ public:
         // bytes_transferred contains total bytes read/written to the websocket stream
         boost::ignore_unused(bytes_transferred);
 
-        if(ec)
-            return fail(ec, "write");
+        if(ec) {
+            fail(ec, "write");
+            outbox_.clear();
+            return release_if_idle();
+        }
 
-        std::cout << "Sent " << bytes_transferred << " bytes" << "\n"; 
+        if (verbose_) {
+            std::cout << "Sent " << bytes_transferred << " bytes" << "\n";
+        }
 
+        metrics_->messages_out.inc();
+        metrics_->bytes_out.inc(bytes_transferred);
+        trace::complete("ws.write", write_start_, outbox_.front().tag);
         outbox_.pop_front();
 
         if(outbox_.empty()){
-             return;
+             return release_if_idle();
         }
 
-        ws_.async_write(
-            net::buffer(outbox_.front()),
-            boost::asio::bind_executor(ws_strand_, beast::bind_front_handler( &session::on_write, shared_from_this())));
-
+        do_write();
     }
 
     void on_read(
@@ -249,43 +515,229 @@ public:
     {
         boost::ignore_unused(bytes_transferred);
 
-        if(ec)
-            return fail(ec, "read");
-
-        auto response = beast::buffers_to_string(buffer_.data()).substr(0, bytes_transferred);
-        std::cout << "Received response from server " << "\n";
-        std::cout << response << " by thread ID:" << boost::this_thread::get_id() << std::endl;
-
-        // Check if parsing was successful.
-        try {
-            json j = json::parse(response);
-            auto method_it = j.find("method");
-            if (method_it != j.end() && *method_it == "subscription") {
-                feedQueue_.push(j);
-            }else if (access_token_.empty()) {
-                if (j.contains("result") && j["result"].contains("access_token")) {
-                    access_token_ = j["result"]["access_token"];
-                    std::cout << "Access token set successfully.\n";
-                } else {
-                    std::cerr << "Error: No access token found in response, Authentication required.\n";
-                }
-            }else{
-                inbox_.push(j);
-            }
-        } catch (const json::parse_error& e) {
-            std::cerr << "JSON parse error: " << e.what() << "\n";
+        if(ec) {
+            fail(ec, "read");
+            reading_ = false;
+            heartbeat_timer_.cancel();
+            fail_over(std::string("read: ") + ec.message());
+            return release_if_idle();
+        }
+
+        mark_rx();
+        metrics_->messages_in.inc();
+        metrics_->bytes_in.inc(bytes_transferred);
+        const timestamping_stream& layer = ws_.next_layer().next_layer();
+        const bool timestamped = layer.mode() != rx_timestamping::off;
+        const std::int64_t read_ns = clock_ || timestamped ? ClockSync::now_ns() : 0;
+        frame_received_ns_ = read_ns;
+        if (timestamped && layer.last().software_ns != 0) {
+            // the kernel saw the bytes first; one-way delays start from there
+            frame_received_ns_ = layer.last().software_ns;
+        }
+        if (recorder_) {
+            recorder_->record(connection_id_, buffer_.data().data(), bytes_transferred);
+        }
+
+        std::string_view response(static_cast<const char*>(buffer_.data().data()), bytes_transferred);
+        if (verbose_) {
+            std::cout << "Received response from server " << "\n";
+            std::cout << response << " by thread ID:" << boost::this_thread::get_id() << std::endl;
+        }
+
+        tsc_clock::ticks parse_start = tsc_clock::now();
+        dispatcher_.dispatch(response, frame_received_ns_);
+        tsc_clock::ticks parse_end = tsc_clock::now();
+        trace::complete("ws.dispatch", parse_start);
+        metrics_->parse_latency.observe(tsc_clock::elapsed(parse_start, parse_end));
+        if (timestamped) {
+            record_rx_stages(layer.last(), read_ns, parse_end - parse_start);
         }
-        
+
         // Clear the buffer
         buffer_.consume(buffer_.size());
 
         // on read loop
-        ws_.async_read(
-            buffer_,
-            boost::asio::bind_executor(ws_strand_, beast::bind_front_handler( &session::on_read, shared_from_this())));
+        do_read();
+    }
+
+    // Asks the exchange for heartbeats and starts the ping schedule. Strand only.
+    void start_heartbeat() {
+        jsonrpc j("public/set_heartbeat");
+        j["params"] = {
+            {"interval", heartbeat_.exchange_interval.count()}
+        };
+        j["id"] = std::string(heartbeat_id_prefix) + "set";
+        enqueue(j.dump());
+        request_time();
+        schedule_heartbeat();
+    }
+
+    void request_time() {
+        if (!clock_) {
+            return;
+        }
+        jsonrpc j("public/get_time");
+        std::uint64_t seq = ++time_seq_;
+        j["id"] = std::string(heartbeat_id_prefix) + "time-" + std::to_string(seq);
+        std::string message = j.dump();
+        last_time_request_ = std::chrono::steady_clock::now();
+        // stamped as late as possible; a sample delayed behind other writes only
+        // has a longer RTT and is filtered out
+        time_requests_[seq] = ClockSync::now_ns();
+        enqueue(std::move(message));
+    }
+
+    void schedule_heartbeat() {
+        heartbeat_timer_.expires_after(heartbeat_.ping_interval);
+        // the timer outlives neither the session nor its strand; a weak reference
+        // lets an idle session go away without waiting for the next tick
+        heartbeat_timer_.async_wait([weak = weak_from_this()](beast::error_code ec) {
+            auto self = weak.lock();
+            if (ec || !self) {
+                return;
+            }
+            self->on_heartbeat_timer();
+        });
+    }
+
+    void on_heartbeat_timer() {
+        if (!reading_ || closing_ || failed_over_) {
+            return;
+        }
+        tsc_clock::recalibrate();
+        auto now = std::chrono::steady_clock::now();
+        auto silent = tsc_clock::elapsed(last_rx_.load());
+        if (silent > heartbeat_.liveness_timeout) {
+            return fail_over("no inbound traffic for " +
+                std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(silent).count()) + " ms");
+        }
+        if (clock_ && (clock_->sample_count() < 8 || now - last_time_request_ >= heartbeat_.clock_sample_interval)) {
+            request_time();
+        }
+        if (!ping_in_flight_) {
+            ping_in_flight_ = true;
+            ping_sent_ = tsc_clock::now();
+            ping_payload_ = std::to_string(++ping_seq_);
+            ws_.async_ping(websocket::ping_data(ping_payload_.c_str()),
+                boost::asio::bind_executor(ws_strand_, [self = shared_from_this()](beast::error_code ec) {
+                    if (ec && ec != net::error::operation_aborted) {
+                        fail(ec, "ping");
+                    }
+                }));
+        }
+        schedule_heartbeat();
+    }
+
+    void on_control(websocket::frame_type kind, beast::string_view payload) {
+        mark_rx();
+        // a pong for an older ping (or an unsolicited one) is not a sample
+        if (kind != websocket::frame_type::pong || !ping_in_flight_ || payload != ping_payload_) {
+            return;
+        }
+        ping_in_flight_ = false;
+        auto rtt = tsc_clock::elapsed(ping_sent_);
+        ping_rtt_.record(rtt);
+        metrics_->ping_rtt.observe(rtt);
+    }
+
+    void on_exchange_heartbeat(const json& j) {
+        ++exchange_heartbeats_;
+        auto params_it = j.find("params");
+        if (params_it == j.end() || params_it->value("type", "") != "test_request") {
+            return;
+        }
+        // answer right away on the strand; a missed test_request closes the connection
+        ++test_requests_;
+        jsonrpc reply("public/test");
+        reply["id"] = std::string(heartbeat_id_prefix) + "test";
+        enqueue(reply.dump());
+    }
+
+    bool on_heartbeat_response(const json& j) {
+        auto id_it = j.find("id");
+        if (id_it == j.end() || !id_it->is_string()
+            || !id_it->get_ref<const std::string&>().starts_with(heartbeat_id_prefix)) {
+            return false;
+        }
+        if (j.contains("error")) {
+            std::cerr << "Heartbeat request failed: " << j["error"].dump() << "\n";
+            return true;
+        }
+        std::string_view id = id_it->get_ref<const std::string&>();
+        id.remove_prefix(heartbeat_id_prefix.size());
+        if (id.starts_with("time-")) {
+            on_time_response(std::stoull(std::string(id.substr(5))), j);
+        }
+        return true;
+    }
+
+    void on_time_response(std::uint64_t seq, const json& j) {
+        auto it = time_requests_.find(seq);
+        if (it == time_requests_.end()) {
+            return;
+        }
+        std::int64_t sent_ns = it->second;
+        time_requests_.erase(it);
+        auto result = j.find("result");
+        if (clock_ && result != j.end() && result->is_number_integer()) {
+            clock_->add_sample(sent_ns, result->get<std::int64_t>(), frame_received_ns_);
+        }
+    }
+
+    void record_rx_stages(const rx_timestamp& rx, std::int64_t read_ns, tsc_clock::ticks parse_ticks) {
+        parse_.record(std::chrono::nanoseconds(static_cast<std::int64_t>(tsc_clock::to_ns(parse_ticks))));
+        // a frame assembled from bytes an earlier recvmsg already returned has no
+        // kernel timestamp of its own
+        if (rx.user_ns == last_linked_read_ns_) {
+            return;
+        }
+        last_linked_read_ns_ = rx.user_ns;
+        decrypt_.record(std::chrono::nanoseconds(read_ns - rx.user_ns));
+        if (rx.software_ns != 0) {
+            kernel_to_user_.record(std::chrono::nanoseconds(rx.user_ns - rx.software_ns));
+            if (rx.hardware_ns != 0) {
+                wire_to_kernel_.record(std::chrono::nanoseconds(rx.software_ns - rx.hardware_ns));
+            }
+        }
+    }
+
+    void trace_ack(const json& j) {
+        auto id_it = j.find("id");
+        if (id_it == j.end() || !id_it->is_string()) {
+            return;
+        }
+        auto it = traced_.find(id_it->get_ref<const std::string&>());
+        if (it == traced_.end()) {
+            return;
+        }
+        trace::instant("ws.ack", it->second);
+        trace::async_end("rpc", it->second);
+        traced_.erase(it);
+    }
+
+    void mark_rx() {
+        last_rx_.store(tsc_clock::now(), std::memory_order_relaxed);
+    }
+
+    // Half-open or dropped link: close the socket so the pending read completes,
+    // then let the owner reconnect. Strand only.
+    void fail_over(const std::string& reason) {
+        if (failed_over_ || closing_) {
+            return;
+        }
+        failed_over_ = true;
+        heartbeat_timer_.cancel();
+        traced_.clear();
+        std::cerr << "Connection " << connection_id_ << " lost (" << reason << "), failing over.\n";
+        beast::error_code ignored;
+        beast::get_lowest_layer(ws_).socket().close(ignored);
+        if (failover_handler_) {
+            failover_handler_(*this, reason);
+        }
     }
 
     void close_websocket(){
+        closing_ = true;
         ws_.async_close(websocket::close_code::normal,
             boost::asio::bind_executor(ws_strand_, beast::bind_front_handler(
                 &session::on_close, shared_from_this())));
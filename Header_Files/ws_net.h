@@ -1,5 +1,13 @@
 #pragma once
 #include "common.h"
 #include "json_rpc.h"
+#include "fixed_point.h"
 #include "websocket.h"
-#include "utils.h"
\ No newline at end of file
+#include "metrics_server.h"
+#include "coro_session.h"
+#include "utils.h"
+#include "order_manager.h"
+#include "instruments.h"
+#include "replay.h"
+#include "bench.h"
+#include "batch.h"
\ No newline at end of file
@@ -1,34 +1,116 @@
 #include <ws_net.h>
+#include <future>
 
 int main(int ac, char* av[]) {
     std::atomic<bool> running(true);
     po::options_description desc = configure_help_options();
 
     std::atomic<bool> show_subscriptions(false);
+
+    // deribitOEMSBinary --batch <file|->
+    std::string startup_batch;
+    po::options_description startup_options("Startup options");
+    startup_options.add_options()
+        ("batch", po::value<std::string>(&startup_batch), "Run a batch file ('-' for stdin) and exit");
+    try {
+        po::variables_map startup_vm;
+        po::store(po::parse_command_line(ac, av, startup_options), startup_vm);
+        po::notify(startup_vm);
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n" << startup_options << "\n";
+        return 1;
+    }
+
     std::cout << "Welcome to the Deribit Test CLI ! Type '--help' for options.\n";
+    trace::set_thread_name("cli");
 
     // The io_context is required for all I/O
     net::io_context ioc;
     const int ioc_threads = 2;
     std::vector<std::thread> ioc_thread_pool;
 
-    // to store responses from server
-    RpcQueue inbox;
-    RpcQueue feedQueue;
+    // to store responses from server; bounded so a stalled consumer shows up as drops
+    RpcQueue inbox(65536, overflow_policy::drop_oldest);
+    RpcQueue feedQueue(65536, overflow_policy::drop_oldest);
+    // latest value per channel for channels where only the newest update matters
+    ConflatedFeed conflatedFeed;
+    const std::vector<std::string> conflated_channels = {"ticker.", "deribit_price_index."};
+    // subscribed channels interned into ids, kept in step by the subscribe commands
+    auto channels = std::make_shared<channel_registry>();
+    channels->set_conflation(conflated_channels);
+    // Mirrors a (un)subscribe request into the channel registry.
+    auto sync_channels = [&](const json& request) {
+        std::string method = request.value("method", "");
+        if (method == "private/unsubscribe_all") {
+            channels->unsubscribe_all();
+        } else if (method == "private/subscribe" || method == "private/unsubscribe") {
+            auto names = request["params"]["channels"].get<std::vector<std::string>>();
+            if (method == "private/subscribe") {
+                channels->subscribe(names);
+            } else {
+                channels->unsubscribe(names);
+            }
+        }
+    };
+
+    // order state correlated from buy/sell/edit/cancel responses
+    OrderManager order_manager;
+
+    // instrument metadata (tick/lot sizes, expiry) from the on-disk cache, refreshed on connect
+    InstrumentRegistry instruments;
+    const std::string instrument_cache = "instruments.cache";
+    if (instruments.load(instrument_cache)) {
+        std::cout << "Loaded " << instruments.size() << " instruments from " << instrument_cache << ".\n";
+    }
 
     // The SSL context is required, and holds certificates
     ssl::context ctx{ssl::context::tlsv12_client};
     // This holds the root certificate used for verification
     ctx.set_default_verify_paths();
 
-    // Shared pointer to manage WebSocket session
-    std::shared_ptr<session> ws_session;
+    // raw frame capture, attached to the session while --record is active
+    std::shared_ptr<FrameRecorder> recorder;
+
+    // frame decoding mode for live sessions and replays
+    decode_mode frame_decode_mode = default_decode_mode;
+
+    // Shared pointer to manage WebSocket session. Replaced from an I/O thread on
+    // failover, so it is only touched under session_mutex; the command loop works
+    // on a snapshot taken per command.
+    std::mutex session_mutex;
+    std::shared_ptr<session> live_session;
+    // liveness settings for the next connection, guarded by session_mutex
+    heartbeat_config heartbeat;
+    // SO_TIMESTAMPING mode for the next connection, guarded by session_mutex
+    rx_timestamping receive_timestamping = rx_timestamping::off;
+    // exchange clock estimate, kept across reconnects
+    auto exchange_clock = std::make_shared<ClockSync>();
+    auto current_session = [&] {
+        std::lock_guard<std::mutex> lock(session_mutex);
+        return live_session;
+    };
+
+    // Prometheus metrics; every sampled series below reads an atomic
+    metrics::registry metrics_registry;
+    metrics::counter reconnects;
+    std::shared_ptr<metrics_server> metrics_endpoint;
+    const unsigned short default_metrics_port = 9464;
+    metrics_registry.add_sampled("oems_queue_depth", "Messages waiting in a queue.", metrics::kind::gauge,
+        "queue=\"inbox\"", [&] { return static_cast<double>(inbox.depth()); });
+    metrics_registry.add_sampled("oems_queue_depth", "Messages waiting in a queue.", metrics::kind::gauge,
+        "queue=\"feed\"", [&] { return static_cast<double>(feedQueue.depth()); });
+    metrics_registry.add_sampled("oems_queue_depth", "Messages waiting in a queue.", metrics::kind::gauge,
+        "queue=\"conflated\"", [&] { return static_cast<double>(conflatedFeed.depth()); });
+    metrics_registry.add_sampled("oems_reconnects_total", "Reconnects after a lost connection.", metrics::kind::counter,
+        "", [&] { return static_cast<double>(reconnects.value()); });
+    metrics_registry.add_sampled("oems_order_rejects_total", "Order requests rejected by the exchange.", metrics::kind::counter,
+        "", [&] { return static_cast<double>(order_manager.rejects()); });
 
     // for signal handler to exit cleanly
     boost::asio::signal_set signals(ioc, SIGINT, SIGTERM);
     signals.async_wait([&](const boost::system::error_code& ec, int signal_number){
         std::cout << "signal " << ::strsignal(signal_number) << " (" << ec.message() << ")" << "\n";
-        if (ws_session) {
+        if (auto ws_session = current_session()) {
             std::cout << "Closing WebSocket connection...\n";
             ws_session->close_websocket();
         }
@@ -37,19 +119,200 @@ int main(int ac, char* av[]) {
         std::cout << "stopped the process";
     });
 
+    // periodic background refresh of the instrument registry
+    net::steady_timer instrument_refresh_timer(ioc);
+    const auto instrument_refresh_interval = std::chrono::minutes(15);
+    std::function<void(std::weak_ptr<session>)> schedule_instrument_refresh =
+        [&](std::weak_ptr<session> weak) {
+            instrument_refresh_timer.expires_after(instrument_refresh_interval);
+            instrument_refresh_timer.async_wait([&, weak](const boost::system::error_code& ec) {
+                auto s = weak.lock();
+                if (ec || !s) {
+                    return;
+                }
+                std::string message = instruments.make_refresh_request().dump();
+                s->send_message(message);
+                schedule_instrument_refresh(weak);
+            });
+        };
+
+    // responses of the batch in flight, correlated by request id
+    BatchTracker batch_tracker;
+    std::atomic<bool> session_open(false);
+
+    auto send_auth = [&](session& s) {
+        jsonrpc j("public/auth");
+        j["params"] = {
+            {"grant_type", "client_credentials"},
+            {"client_id", "5LlATT7V"},
+            {"client_secret", "p9hjUS1ohjMnXDt9yMVa7qZiODeAf-IWn943Zs0BOFU"}
+        };
+        std::string auth_message = j.dump();
+        s.send_message(auth_message);
+    };
+
+    // Opens a new session; reauthenticate sends the credentials as soon as it is
+    // open, which is how a failed-over session picks up where the lost one was.
+    std::function<void(bool)> connect_session = [&](bool reauthenticate) {
+        session_open.store(false, std::memory_order_release);
+        auto ws_session = std::make_shared<session>(ioc, ctx, inbox,feedQueue);
+        {
+            std::lock_guard<std::mutex> lock(session_mutex);
+            ws_session->set_heartbeat_config(heartbeat);
+            ws_session->set_rx_timestamping(receive_timestamping);
+        }
+        ws_session->set_clock_sync(exchange_clock);
+        metrics_registry.add_connection(ws_session->connection_id(), ws_session->get_metrics());
+        ws_session->set_conflated_feed(conflatedFeed, conflated_channels);
+        // a new connection starts without subscriptions; ids stay interned
+        channels->unsubscribe_all();
+        ws_session->set_channel_registry(channels);
+        ws_session->set_decode_mode(frame_decode_mode);
+        ws_session->set_response_handler([&](session& s, const json& response) {
+            std::vector<jsonrpc> follow_up;
+            if (instruments.on_response(response, follow_up)) {
+                for (auto& request : follow_up) {
+                    std::string message = request.dump();
+                    s.send_message(message);
+                }
+                if (!instruments.refreshing()) {
+                    // persist off the strand
+                    net::post(ioc, [&] {
+                        if (!instruments.save(instrument_cache)) {
+                            std::cerr << "Failed to write " << instrument_cache << "\n";
+                        }
+                    });
+                }
+                return true;
+            }
+            bool in_batch = batch_tracker.on_response(response);
+            order_manager.on_response(response);
+            return in_batch;
+        });
+        ws_session->set_open_handler([&, reauthenticate](session& s) {
+            session_open.store(true, std::memory_order_release);
+            if (reauthenticate) {
+                send_auth(s);
+            }
+            std::string message = instruments.make_refresh_request().dump();
+            s.send_message(message);
+            schedule_instrument_refresh(s.weak_from_this());
+        });
+        ws_session->set_failover_handler([&](session& lost, const std::string&) {
+            bool was_authenticated = !lost.get_access_token().empty();
+            // reconnect from outside the lost session's strand
+            net::post(ioc, [&, was_authenticated] {
+                if (running.load(std::memory_order_acquire)) {
+                    reconnects.inc();
+                    std::cout << "Reconnecting to Deribit...\n";
+                    connect_session(was_authenticated);
+                }
+            });
+        });
+
+        if (recorder) {
+            ws_session->set_recorder(recorder);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(session_mutex);
+            live_session = ws_session;
+        }
+        ws_session->run("test.deribit.com", "443","/ws/api/v2");
+    };
+
+    // Parses, encodes and sends a whole batch, then waits for its responses.
+    // Returns true when every command got a response.
+    auto run_batch = [&](const std::string& path) {
+        auto ws_session = current_session();
+        if (!ws_session || ws_session->get_access_token().empty()) {
+            std::cout << "Error: Access token not set. Please authenticate first.\n";
+            return false;
+        }
+        std::ifstream file;
+        if (path != "-") {
+            file.open(path);
+            if (!file) {
+                throw std::invalid_argument("Cannot open batch file '" + path + "'.");
+            }
+        }
+        std::vector<batch_command> commands = parse_batch(path == "-" ? std::cin : file, instruments, order_manager);
+
+        std::vector<std::string> messages;
+        std::vector<trace::tag> tags;
+        messages.reserve(commands.size());
+        tags.reserve(commands.size());
+        for (auto& command : commands) {
+            if (command.order_request) {
+                order_manager.track_request(command.request);
+            }
+            sync_channels(command.request);
+            messages.push_back(std::move(command.message));
+            tags.push_back(trace::tag_of(command.request));
+        }
+        batch_tracker.start(commands);
+        ws_session->send_batch(std::move(messages), std::move(tags));
+        std::cout << "Sent " << commands.size() << " batch commands.\n";
+
+        bool complete = batch_tracker.wait(std::chrono::seconds(30));
+        if (!complete) {
+            std::cout << "Timed out waiting for batch responses.\n";
+        }
+        batch_tracker.print(std::cout, commands);
+        return complete;
+    };
+
+    // Polls until ready() holds; the session reports progress asynchronously.
+    auto wait_until = [](auto ready, std::chrono::seconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!ready()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return true;
+    };
+
     // Start the io_context in multiple threads
     for (int i = 0; i < ioc_threads; ++i) {
-        ioc_thread_pool.emplace_back([&ioc] {
+        ioc_thread_pool.emplace_back([&ioc, i] {
+            trace::set_thread_name("io " + std::to_string(i));
             ioc.run();
         });
     }
 
-    while (running) {
+    // non-interactive mode: connect, authenticate, run the batch and exit
+    if (!startup_batch.empty()) {
+        int status = 1;
         try {
-            po::options_description cmdline_options("Available inputs");
-            configure_cmdline_options(cmdline_options);
+            connect_session(true);
+            if (!wait_until([&] { return session_open.load(std::memory_order_acquire); }, std::chrono::seconds(30))) {
+                throw std::runtime_error("Timed out connecting to Deribit.");
+            }
+            if (!wait_until([&] { return !current_session()->get_access_token().empty(); }, std::chrono::seconds(10))) {
+                throw std::runtime_error("Timed out authenticating.");
+            }
+            status = run_batch(startup_batch) ? 0 : 1;
+        } catch (const std::exception& e) {
+            std::cout << "Error: " << e.what() << "\n";
+        }
+        if (auto ws_session = current_session()) {
+            ws_session->close_websocket();
+        }
+        ioc.stop();
+        for (auto& t : ioc_thread_pool) {
+            t.join();
+        }
+        return status;
+    }
+
+    // reused across lines; its values are views into input_line
+    std::string input_line;
+    command_line cmd;
 
-            std::string input_line;
+    while (running) {
+        try {
             std::cout << "\\Deribit > $"; // Prompt for input
             if (!std::getline(std::cin, input_line)) {  // Check for EOF or errors
                 std::cerr << "\nInput stream closed. Exiting command loop...\n";
@@ -57,24 +320,20 @@ int main(int ac, char* av[]) {
                 break;
             }
 
-            if(input_line.empty()) {
+            cmd.parse(input_line);
+            if(cmd.empty()) {
                 continue; // Skip empty input
             }
+            std::shared_ptr<session> ws_session = current_session();
 
-            std::vector<std::string> args = po::split_unix(input_line);
-
-            po::variables_map vm;
-            po::store(po::command_line_parser(args).options(cmdline_options).run(), vm);
-            po::notify(vm);
-
-            if(vm.count("help")) {
-                if(args.size()>1){
+            if(cmd.has(option::help)) {
+                if(cmd.token_count()>1){
                     std::cout << "Usage: --help" <<"\n";
                     continue;
                 }
                 std::cout << desc << "\n";
-            }else if (vm.count("connect")) {
-                if(args.size()>1){
+            }else if (cmd.has(option::connect)) {
+                if(cmd.token_count()>1){
                     std::cout << "Usage: --connect" <<"\n";
                     continue;
                 }
@@ -83,11 +342,9 @@ int main(int ac, char* av[]) {
                     continue;
                 }
 
-                ws_session = std::make_shared<session>(ioc, ctx, inbox,feedQueue);
-
-                ws_session->run("test.deribit.com", "443","/ws/api/v2");
-            }else if(vm.count("auth")){
-                if(args.size()>1){
+                connect_session(false);
+            }else if(cmd.has(option::auth)){
+                if(cmd.token_count()>1){
                     std::cout << "Usage: --auth" <<"\n";
                     continue;
                 }
@@ -95,16 +352,9 @@ int main(int ac, char* av[]) {
                     std::cout << "Not connected to Deribit. Please connect before authenticating.\n";
                     continue;
                 }
-                jsonrpc j("public/auth");
-                j["params"] = {
-                    {"grant_type", "client_credentials"},
-                    {"client_id", "5LlATT7V"},
-                    {"client_secret", "p9hjUS1ohjMnXDt9yMVa7qZiODeAf-IWn943Zs0BOFU"}
-                };
-                std::string auth_message = j.dump();
-                ws_session->send_message(auth_message);
+                send_auth(*ws_session);
             } 
-            else if(vm.count("place")){
+            else if(cmd.has(option::place)){
                 //--place direction=<> instrument_name=<> type=<> 
                 //--place --direction buy --instrument_name ETH-PERPETUAL --type limit --amount 40 --price 1500
                 //--place --direction sell --instrument_name ETH-PERPETUAL --type stop_limit --amount 10 --price 145.6 --trigger_price 145 --trigger last_price
@@ -112,14 +362,15 @@ int main(int ac, char* av[]) {
                     std::cout << "Error: Access token not set. Please authenticate first.\n";
                     continue;
                 }
-                validate_place_order(vm);
-                jsonrpc j = store_required_values(vm);
+                validate_place_order(cmd, instruments);
+                jsonrpc j = store_required_values(cmd);
+                order_manager.track_request(j);
                 std::string message = j.dump();
-                ws_session->send_message(message); // Send the message
+                ws_session->send_message(message, trace::tag_of(j)); // Send the message
                 std::cout << "Place order request sent.\n";
-            }else if(vm.count("cancel")){
+            }else if(cmd.has(option::cancel)){
                 //--cancel --order_id ETH-SLIS-12
-                if(args.size()>3){
+                if(cmd.token_count()>3){
                     std::cout << "Usage: --cancel [options]\n\nOptions:\n  --order_id <string>" <<"\n";
                     continue;
                 }
@@ -129,45 +380,348 @@ int main(int ac, char* av[]) {
                 }
 
                 //by order id.
-                if (!vm.count("order_id")) {
-                    throw std::invalid_argument("Missing required parameter for cancel: --order_id.");
-                }
-
-                jsonrpc j("/private/cancel");
-                j["params"] = {
-                    {"order_id", vm["order_id"].as<std::string>()},
-                };
+                jsonrpc j = make_cancel_request(cmd);
+                auto cancelled = order_manager.find(cmd.str(option::order_id));
+                order_manager.track_request(j);
                 std::string message = j.dump();
-                ws_session->send_message(message);
+                ws_session->send_message(message, trace::tag_of(j, cancelled ? cancelled->instrument_name() : std::string_view()));
                 std::cout << "cancel order request sent.\n";
-            }else if(vm.count("get_order_book")){
-                //--get_order_book --instrument_name BTC-PERPETUAL --depth 5
-                if(args.size()>5){
-                    std::cout << "Usage: --get_order_book [options]\n\nOptions:\n  --instrument_name <string>\n  --depth <int>" <<"\n";
+            }else if(cmd.has(option::edit)){
+                //--edit --order_id ETH-SLIS-12 --amount 20 --price 1510
+                if (!ws_session || ws_session->get_access_token().empty()) {
+                    std::cout << "Error: Access token not set. Please authenticate first.\n";
+                    continue;
+                }
+                auto tracked = cmd.has(option::order_id) ? order_manager.find(cmd.str(option::order_id)) : std::nullopt;
+                validate_edit_order(cmd, instruments.ticks().lookup(tracked ? tracked->instrument : no_symbol));
+                jsonrpc j = store_edit_values(cmd);
+                order_manager.track_request(j);
+                std::string message = j.dump();
+                ws_session->send_message(message, trace::tag_of(j, tracked ? tracked->instrument_name() : std::string_view()));
+                std::cout << "edit order request sent.\n";
+            }else if(cmd.has(option::orders)){
+                if(cmd.token_count()>1){
+                    std::cout << "Usage: --orders" <<"\n";
                     continue;
                 }
-                std::unordered_set <int> valid_depths = {1,5,10,20,50,100,1000,10000};
-                if(vm["instrument_name"].as<std::vector<std::string>>().size() > 1){
-                    throw std::invalid_argument("Only one 'instrument_name' is allowed for the 'place' command.");
+                order_manager.print(std::cout);
+            }else if(cmd.has(option::instruments)){
+                //--instruments [--instrument_name BTC-PERPETUAL]
+                if (cmd.has(option::instrument_name)) {
+                    for (std::string_view name : cmd.list(option::instrument_name)) {
+                        auto info = instruments.get(name);
+                        if (!info) {
+                            std::cout << name << ": unknown\n";
+                            continue;
+                        }
+                        std::cout << info->id << "  " << info->name() << "  " << to_string(info->kind)
+                                  << "  tick=" << info->scale.tick_string() << "  lot=" << info->scale.lot_string()
+                                  << "  contract_size=" << info->contract_size << "  min_trade_amount=" << info->min_trade_amount
+                                  << "  expiry=" << info->expiration_timestamp << (info->active ? "" : "  (inactive)") << "\n";
+                    }
+                    continue;
+                }
+                std::cout << instruments.size() << " instruments known" << (instruments.refreshing() ? ", refresh in progress" : "") << ".\n";
+            }else if(cmd.has(option::feed)){
+                if(cmd.token_count()>1){
+                    std::cout << "Usage: --feed" <<"\n";
+                    continue;
+                }
+                std::string channel;
+                lazy_json j;
+                std::uint64_t conflated;
+                while (conflatedFeed.try_pop(channel, j, conflated)) {
+                    std::cout << channel << " (" << conflated << " conflated): " << j.get()["params"]["data"].dump() << "\n";
+                }
+                std::size_t queued = 0;
+                while (feedQueue.try_pop(j)) {
+                    ++queued;
+                }
+                std::cout << queued << " notifications drained from other channels.\n";
+            }else if(cmd.has(option::session_stats)){
+                if (!ws_session) {
+                    std::cout << "Not connected.\n";
+                    continue;
+                }
+                auto stats = ws_session->get_handler_stats();
+                std::cout << "read loop: " << stats.read_heap << " heap / " << stats.read_reused << " recycled handler allocations\n"
+                          << "write loop: " << stats.write_heap << " heap / " << stats.write_reused << " recycled handler allocations\n";
+                auto rx = ws_session->get_rx_stage_stats();
+                if (rx.parse.samples != 0) {
+                    print_latency_summary(std::cout, "wire->kernel", rx.wire_to_kernel);
+                    print_latency_summary(std::cout, "kernel->user", rx.kernel_to_user);
+                    print_latency_summary(std::cout, "decrypt", rx.decrypt);
+                    print_latency_summary(std::cout, "parse", rx.parse);
+                }
+            }else if(cmd.has(option::heartbeat)){
+                //--heartbeat --ping_interval 500 --liveness_timeout 3000
+                if (cmd.has(option::ping_interval) || cmd.has(option::liveness_timeout)) {
+                    std::lock_guard<std::mutex> lock(session_mutex);
+                    heartbeat_config next = heartbeat;
+                    next.ping_interval = std::chrono::milliseconds(cmd.integer(option::ping_interval, next.ping_interval.count()));
+                    next.liveness_timeout = std::chrono::milliseconds(cmd.integer(option::liveness_timeout, next.liveness_timeout.count()));
+                    validate_heartbeat_config(next);
+                    heartbeat = next;
+                    std::cout << "Ping every " << heartbeat.ping_interval.count() << " ms, fail over after "
+                              << heartbeat.liveness_timeout.count() << " ms of silence (from the next connection).\n";
+                    continue;
+                }
+                if (!ws_session) {
+                    std::cout << "Not connected.\n";
+                    continue;
+                }
+                auto stats = ws_session->get_liveness_stats();
+                std::cout << "connection " << ws_session->connection_id() << ": last inbound frame "
+                          << stats.since_last_rx.count() << " ms ago, " << stats.exchange_heartbeats
+                          << " exchange heartbeats, " << stats.test_requests << " test requests answered\n";
+                print_latency_summary(std::cout, "ping rtt", stats.ping_rtt);
+            }else if(cmd.has(option::clock)){
+                if(cmd.token_count()>1){
+                    std::cout << "Usage: --clock" <<"\n";
+                    continue;
+                }
+                if (tsc_clock::invariant()) {
+                    std::cout << "probe clock: invariant TSC at " << 1.0 / tsc_clock::ns_per_tick() << " GHz\n";
+                } else {
+                    std::cout << "probe clock: steady_clock (no invariant TSC)\n";
                 }
-                if (!vm.count("instrument_name") || vm["instrument_name"].as<std::vector<std::string>>().empty() || !vm.count("depth")) {
-                    throw std::invalid_argument("Missing required parameters for get_order_book: --instrument_name and --depth.");
+                clock_estimate clock = exchange_clock->estimate();
+                if (!clock.valid) {
+                    std::cout << "No public/get_time samples yet. Please connect first.\n";
+                    continue;
+                }
+                std::cout << "exchange - local: " << clock.offset_ns / 1000 << " us, drift " << clock.drift_ppm
+                          << " ppm, best rtt " << clock.best_rtt_ns / 1000 << " us (" << clock.trusted << " of "
+                          << clock.samples << " samples trusted)\n";
+                if (!ws_session) {
+                    continue;
+                }
+                print_latency_summary(std::cout, "one-way delay", ws_session->get_one_way_delay());
+            }else if(cmd.has(option::queue_stats)){
+                //--queue_stats --watch 10
+                int watch = cmd.has(option::watch) ? cmd.integer(option::watch) : 0;
+                for (int i = 0; ; ++i) {
+                    print_queue_stats(std::cout, "inbox", inbox.stats());
+                    print_queue_stats(std::cout, "feed", feedQueue.stats());
+                    print_queue_stats(std::cout, "conflated", conflatedFeed.stats());
+                    if (i >= watch - 1) {
+                        break;
+                    }
+                    std::this_thread::sleep_for(std::chrono::seconds(1));
+                    std::cout << "\n";
+                }
+            }else if(cmd.has(option::queue_config)){
+                //--queue_config --queue feed --capacity 10000 --policy drop_oldest
+                if (!cmd.has(option::queue) || !cmd.has(option::capacity) || !cmd.has(option::policy)) {
+                    throw std::invalid_argument("Missing required parameters for queue_config: --queue, --capacity and --policy.");
+                }
+                const std::string name = cmd.str(option::queue);
+                if (name != "inbox" && name != "feed") {
+                    throw std::invalid_argument("Invalid 'queue'. Must be 'inbox' or 'feed'.");
+                }
+                RpcQueue& queue = name == "inbox" ? inbox : feedQueue;
+                queue.configure(static_cast<std::size_t>(cmd.integer(option::capacity)), parse_overflow_policy(cmd.str(option::policy)));
+                print_queue_stats(std::cout, name.c_str(), queue.stats());
+            }else if(cmd.has(option::record)){
+                //--record --path captures/btc
+                if (!cmd.has(option::path)) {
+                    throw std::invalid_argument("Missing required parameter for record: --path.");
+                }
+                if (recorder) {
+                    std::cout << "Already recording to " << recorder->prefix() << ". Use --record_stop first.\n";
+                    continue;
+                }
+                recorder = std::make_shared<FrameRecorder>(cmd.str(option::path));
+                if (ws_session) {
+                    ws_session->set_recorder(recorder);
+                }
+                std::cout << "Recording frames to " << segment_path(recorder->prefix(), 0) << "\n";
+            }else if(cmd.has(option::record_stop)){
+                if (!recorder) {
+                    std::cout << "Not recording.\n";
+                    continue;
+                }
+                if (ws_session) {
+                    ws_session->set_recorder(nullptr);
                 }
-                if(valid_depths.find(vm["depth"].as<int>()) == valid_depths.end()){
-                    throw std::invalid_argument("Depth has an invalid value. valid depths are {1,5,10,20,50,100,1000,10000}");
+                recorder->stop();
+                recorder_stats stats = recorder->stats();
+                std::cout << "Recorded " << stats.frames_recorded << " frames (" << stats.bytes_written << " bytes) in "
+                          << stats.segments << " segment(s), dropped " << stats.frames_dropped << ".\n";
+                recorder.reset();
+            }else if(cmd.has(option::rtt)){
+                //--rtt --count 100
+                int count = cmd.integer(option::count, 10);
+                if (count <= 0) {
+                    throw std::invalid_argument("'count' must be positive.");
+                }
+                auto client = std::make_shared<coro_session>(ioc, ctx);
+                std::promise<std::vector<double>> result;
+                auto done = result.get_future();
+                net::co_spawn(client->get_executor(),
+                    [client, count]() -> net::awaitable<std::vector<double>> {
+                        co_await client->connect("test.deribit.com", "443", "/ws/api/v2");
+                        std::vector<double> rtts;
+                        rtts.reserve(count);
+                        for (int i = 0; i < count; ++i) {
+                            tsc_clock::ticks t0 = tsc_clock::now();
+                            json response = co_await client->call("public/test");
+                            rtts.push_back(tsc_clock::to_ns(tsc_clock::now() - t0) / 1000);
+                        }
+                        co_await client->close();
+                        co_return rtts;
+                    },
+                    [&result](std::exception_ptr e, std::vector<double> rtts) {
+                        if (e) {
+                            result.set_exception(e);
+                        } else {
+                            result.set_value(std::move(rtts));
+                        }
+                    });
+                if (done.wait_for(std::chrono::seconds(60)) != std::future_status::ready) {
+                    std::cout << "Timed out waiting for round trips.\n";
+                    continue;
+                }
+                std::vector<double> rtts = done.get();
+                std::sort(rtts.begin(), rtts.end());
+                double sum = 0;
+                for (double r : rtts) {
+                    sum += r;
+                }
+                std::cout << rtts.size() << " round trips: min " << rtts.front() << " us, median " << rtts[rtts.size() / 2]
+                          << " us, mean " << sum / rtts.size() << " us, max " << rtts.back() << " us\n";
+            }else if(cmd.has(option::decode)){
+                //--decode arena
+                frame_decode_mode = parse_decode_mode(cmd.str(option::decode));
+                if (ws_session) {
+                    ws_session->set_decode_mode(frame_decode_mode);
+                }
+                std::cout << "Frame decoding set to " << cmd.str(option::decode) << ".\n";
+            }else if(cmd.has(option::timestamping)){
+                //--timestamping software
+                rx_timestamping mode = parse_rx_timestamping(cmd.str(option::timestamping));
+                {
+                    std::lock_guard<std::mutex> lock(session_mutex);
+                    receive_timestamping = mode;
+                }
+                std::cout << "Receive timestamping set to " << cmd.str(option::timestamping) << " from the next connection.\n";
+            }else if(cmd.has(option::trace)){
+                //--trace dump --path order.json
+                std::string action = cmd.str(option::trace);
+                if (action == "on" || action == "off") {
+                    trace::set_enabled(action == "on");
+                    std::cout << "Tracing " << action << ".\n";
+                } else if (action == "dump") {
+                    if (!cmd.has(option::path)) {
+                        throw std::invalid_argument("Missing required parameter for trace dump: --path.");
+                    }
+                    std::string path = cmd.str(option::path);
+                    std::ofstream out(path);
+                    if (!out) {
+                        throw std::invalid_argument("Cannot open '" + path + "' for writing.");
+                    }
+                    std::size_t events = trace::dump(out);
+                    std::cout << "Wrote " << events << " trace events to " << path << ".\n";
+                } else {
+                    throw std::invalid_argument("Invalid trace action '" + action + "'. Must be 'on', 'off' or 'dump'.");
+                }
+            }else if(cmd.has(option::metrics)){
+                //--metrics on --port 9464
+                std::string action = cmd.str(option::metrics);
+                if (action == "on") {
+                    if (metrics_endpoint) {
+                        throw std::invalid_argument("Metrics are already served on port " + std::to_string(metrics_endpoint->port()) + ".");
+                    }
+                    std::int64_t port = cmd.has(option::port) ? cmd.integer(option::port) : default_metrics_port;
+                    if (port < 0 || port > 65535) {
+                        throw std::invalid_argument("'port' must be between 0 and 65535.");
+                    }
+                    auto server = std::make_shared<metrics_server>(ioc, metrics_registry);
+                    try {
+                        server->start(static_cast<unsigned short>(port));
+                    } catch (const boost::system::system_error& e) {
+                        throw std::invalid_argument("Cannot listen on port " + std::to_string(port) + ": " + e.code().message() + ".");
+                    }
+                    metrics_endpoint = std::move(server);
+                    std::cout << "Serving metrics on http://127.0.0.1:" << metrics_endpoint->port() << "/metrics\n";
+                } else if (action == "off") {
+                    if (metrics_endpoint) {
+                        metrics_endpoint->stop();
+                        metrics_endpoint.reset();
+                    }
+                    std::cout << "Metrics endpoint stopped.\n";
+                } else if (action == "show") {
+                    std::cout << metrics_registry.render();
+                } else {
+                    throw std::invalid_argument("Invalid metrics action '" + action + "'. Must be 'on', 'off' or 'show'.");
+                }
+            }else if(cmd.has(option::bench)){
+                //--bench decode --path captures/btc
+                if (!cmd.has(option::path)) {
+                    throw std::invalid_argument("Missing required parameter for bench: --path.");
+                }
+                run_bench(cmd.str(option::bench), cmd.str(option::path), instruments.ticks(), std::cout);
+            }else if(cmd.has(option::replay)){
+                //--replay --path captures/btc --speed 10
+                if (!cmd.has(option::path)) {
+                    throw std::invalid_argument("Missing required parameter for replay: --path.");
+                }
+                double speed = cmd.number(option::speed);
+                if (speed < 0) {
+                    throw std::invalid_argument("'speed' must not be negative.");
                 }
 
-                jsonrpc j("public/get_order_book");
-                j["params"] = {
-                    {"instrument_name", vm["instrument_name"].as<std::vector<std::string>>()[0]},
-                    {"depth", vm["depth"].as<int>()},
-                };
+                // isolated queues and order state so a replay never touches the live session
+                RpcQueue replay_inbox;
+                RpcQueue replay_feed;
+                ConflatedFeed replay_conflated;
+                OrderManager replay_orders;
+                frame_dispatcher replay_dispatcher(replay_inbox, replay_feed);
+                replay_dispatcher.set_conflation(&replay_conflated, conflated_channels);
+                replay_dispatcher.set_verbose(false);
+                replay_dispatcher.set_decode_mode(frame_decode_mode);
+                replay_dispatcher.set_response_handler([&replay_orders](const json& response) {
+                    replay_orders.on_response(response);
+                    return false;
+                });
+
+                // stands in for the consumers so the queues do not grow with the capture
+                std::atomic<bool> draining(true);
+                std::thread drainer([&] {
+                    lazy_json j;
+                    std::string channel;
+                    std::uint64_t conflated;
+                    while (draining.load(std::memory_order_acquire)) {
+                        bool popped = replay_feed.try_pop(j);
+                        popped = replay_conflated.try_pop(channel, j, conflated) || popped;
+                        popped = replay_inbox.try_pop(j) || popped;
+                        if (!popped) {
+                            std::this_thread::yield();
+                        }
+                    }
+                });
+
+                ReplayEngine engine(replay_dispatcher);
+                replay_stats stats = engine.run(cmd.str(option::path), speed);
+                draining.store(false, std::memory_order_release);
+                drainer.join();
+                stats.print(std::cout);
+            }else if(cmd.has(option::batch)){
+                //--batch orders.txt
+                run_batch(cmd.str(option::batch));
+            }else if(cmd.has(option::get_order_book)){
+                //--get_order_book --instrument_name BTC-PERPETUAL --depth 5
+                if(cmd.token_count()>5){
+                    std::cout << "Usage: --get_order_book [options]\n\nOptions:\n  --instrument_name <string>\n  --depth <int>" <<"\n";
+                    continue;
+                }
+                jsonrpc j = make_order_book_request(cmd, instruments);
 
                 std::string message = j.dump();
                 std::cout << message << "\n\n";
                 ws_session->send_message(message); // Send the message
                 std::cout << "Placed get order book request sent.\n";
-            }else if(vm.count("subscribe")){
+            }else if(cmd.has(option::subscribe)){
                 //--subscribe --channel deribit_price_index --instrument_name btc_usd --channel deribit_price_index --instrument_name eth_usd
                 // subscribe to one or more channels
 
@@ -176,33 +730,15 @@ int main(int ac, char* av[]) {
                     continue;
                 }
 
-                if (!vm.count("instrument_name") || !vm.count("channel")) {
-                    throw std::invalid_argument("Missing required parameters for subscribe: --instrument_name and --channel.");
-                }
-
-                std::vector<std::string> channels = vm["channel"].as<std::vector<std::string>>();
-                std::vector<std::string> instrument_names = vm["instrument_name"].as<std::vector<std::string>>();
-
-                // Validate that the counts match
-                if (channels.size() != instrument_names.size()) {
-                    throw std::invalid_argument("The number of --channel and --instrument_name arguments must match.");
-                }
-
-                std::vector<std::string> subscription_channels;
-                for (size_t i = 0; i < channels.size(); ++i) {
-                    subscription_channels.push_back(channels[i] + "." + instrument_names[i]);
-                }
-
-                jsonrpc j("private/subscribe");
-                j["params"] = {
-                    {"channels", subscription_channels}
-                };
+                jsonrpc j = make_channels_request("private/subscribe", cmd);
+                sync_channels(j);
 
                 std::string message = j.dump();
                 std::cout << message << "\n\n";
                 ws_session->send_message(message); // Send the message
-                std::cout << "subscribe request sent.\n";
-            }else if(vm.count("unsubscribe")){
+                std::cout << "subscribe request sent (" << channels->active_count() << " of "
+                          << channels->size() << " interned channels active).\n";
+            }else if(cmd.has(option::unsubscribe)){
                 //--unsubscribe --channel deribit_price_index --instrument_name btc_usd --channel deribit_price_index --instrument_name eth_usd
                 // unsubscribe to one or more channels
                 if (!ws_session || ws_session->get_access_token().empty()) {
@@ -210,35 +746,16 @@ int main(int ac, char* av[]) {
                     continue;
                 }
 
-                if (!vm.count("instrument_name") || !vm.count("channel")) {
-                    throw std::invalid_argument("Missing required parameters for subscribe: --instrument_name and --channel.");
-                }
-
-                std::vector<std::string> channels = vm["channel"].as<std::vector<std::string>>();
-                std::vector<std::string> instrument_names = vm["instrument_name"].as<std::vector<std::string>>();
-
-                // Validate that the counts match
-                if (channels.size() != instrument_names.size()) {
-                    throw std::invalid_argument("The number of --channel and --instrument_name arguments must match.");
-                }
-
-                std::vector<std::string> unsubscription_channels;
-                for (size_t i = 0; i < channels.size(); ++i) {
-                    unsubscription_channels.push_back(channels[i] + "." + instrument_names[i]);
-                }
-
-                jsonrpc j("private/unsubscribe");
-                j["params"] = {
-                    {"channels", unsubscription_channels}
-                };
+                jsonrpc j = make_channels_request("private/unsubscribe", cmd);
+                sync_channels(j);
 
                 std::string message = j.dump();
                 std::cout << message << "\n\n";
                 ws_session->send_message(message); // Send the message
                 std::cout << "unsubscribe request sent.\n";
-            }else if(vm.count("unsubscribe_all")){
+            }else if(cmd.has(option::unsubscribe_all)){
                 // --unsubscribe_all
-                if(args.size()>1){
+                if(cmd.token_count()>1){
                     std::cout << "Usage: --unsubscribe_all" <<"\n";
                     continue;
                 }
@@ -248,11 +765,12 @@ int main(int ac, char* av[]) {
                 }
 
                 jsonrpc j("private/unsubscribe_all");
+                sync_channels(j);
                 std::string message = j.dump();
                 ws_session->send_message(message); // Send the message
                 std::cout << "unsubscribe all request sent.\n";
-            }else if (vm.count("exit")){
-                if(args.size()>1){
+            }else if (cmd.has(option::exit)){
+                if(cmd.token_count()>1){
                     std::cout << "Usage: --exit" <<"\n";
                     continue;
                 }
@@ -0,0 +1,364 @@
+#include <oems_client.h>
+#include <ws_net.h>
+
+namespace {
+
+void validate_order_entry(const order_entry& order, const InstrumentRegistry& instruments) {
+    if (order.instrument_name.empty()) {
+        throw std::invalid_argument("Missing 'instrument_name'.");
+    }
+    require_known_instrument(instruments, order.instrument_name);
+    const instrument_scale scale = instruments.ticks().lookup(order.instrument_name);
+    require_on_lot(scale, order.amount, "amount");
+
+    const std::string& type = order.type;
+    if (type != "limit" && type != "stop_limit" && type != "market" && type != "stop_market") {
+        throw std::invalid_argument("Invalid 'type'. Must be 'limit', 'stop_limit', 'market' or 'stop_market'.");
+    }
+    if (type == "limit" || type == "stop_limit") {
+        if (!order.price || *order.price <= 0) {
+            throw std::invalid_argument("Missing or invalid 'price'. Must be a positive number.");
+        }
+        require_on_tick(scale, *order.price, "price");
+    }
+    if (type == "stop_limit" || type == "stop_market") {
+        if (!order.trigger_price || *order.trigger_price <= 0) {
+            throw std::invalid_argument("Missing or invalid 'trigger_price'. Must be a positive number.");
+        }
+        require_on_tick(scale, *order.trigger_price, "trigger_price");
+        if (order.trigger != "index_price" && order.trigger != "mark_price" && order.trigger != "last_price") {
+            throw std::invalid_argument("Invalid or missing 'trigger'. Must be one of 'index_price', 'mark_price', or 'last_price'.");
+        }
+    }
+    if (order.label.size() > 64) {
+        throw std::invalid_argument("'label' must not exceed 64 characters.");
+    }
+}
+
+jsonrpc make_order_request(const order_entry& order) {
+    jsonrpc j(order.direction == order_direction::buy ? "private/buy" : "private/sell");
+    j["params"] = {
+        {"instrument_name", order.instrument_name},
+        {"type", order.type},
+        {"amount", order.amount},
+    };
+    if (order.price) {
+        j["params"]["price"] = *order.price;
+    }
+    if (order.trigger_price) {
+        j["params"]["trigger_price"] = *order.trigger_price;
+    }
+    if (!order.trigger.empty()) {
+        j["params"]["trigger"] = order.trigger;
+    }
+    if (!order.label.empty()) {
+        j["params"]["label"] = order.label;
+    }
+    if (order.post_only) {
+        j["params"]["post_only"] = true;
+    }
+    if (order.reject_post_only) {
+        j["params"]["reject_post_only"] = true;
+    }
+    return j;
+}
+
+} // namespace
+
+struct oems_client::impl {
+    explicit impl(oems_config c)
+        : config(std::move(c))
+        , work(net::make_work_guard(ioc))
+    {
+        ctx.set_default_verify_paths();
+        if (!config.instrument_cache.empty()) {
+            instruments.load(config.instrument_cache);
+        }
+        for (int i = 0; i < std::max(1, config.io_threads); ++i) {
+            threads.emplace_back([this, i] {
+                trace::set_thread_name("oems io " + std::to_string(i));
+                ioc.run();
+            });
+        }
+    }
+
+    // Runs on the session strand.
+    bool on_response(session& s, const json& response) {
+        std::vector<jsonrpc> follow_up;
+        if (instruments.on_response(response, follow_up)) {
+            for (auto& request : follow_up) {
+                std::string message = request.dump();
+                s.send_message(message);
+            }
+            if (!instruments.refreshing() && !config.instrument_cache.empty()) {
+                // persist off the strand
+                net::post(ioc, [this] {
+                    instruments.save(config.instrument_cache);
+                });
+            }
+            return true;
+        }
+        orders.on_response(response);
+
+        auto id_it = response.find("id");
+        if (id_it == response.end() || !id_it->is_string()) {
+            return false;
+        }
+        const std::string& id = id_it->get_ref<const std::string&>();
+        response_callback callback;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (id == auth_id) {
+                authenticated = response.contains("result") && response["result"].contains("access_token");
+                auth_done = true;
+                cv.notify_all();
+                // fall through so the session keeps the access token
+                return false;
+            }
+            auto it = callbacks.find(id);
+            if (it == callbacks.end()) {
+                return false;
+            }
+            callback = std::move(it->second);
+            callbacks.erase(it);
+        }
+        if (callback) {
+            callback(response);
+        }
+        return true;
+    }
+
+    bool on_notification(const json& j) {
+        if (!notification) {
+            return false;
+        }
+        const json& params = j["params"];
+        notification(params.value("channel", ""), params.contains("data") ? params["data"] : json());
+        return true;
+    }
+
+    // Runs on the lost session's strand.
+    void on_failover(session& lost, const std::string& reason) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (ws.get() != &lost) {
+                return;
+            }
+            ws.reset();
+            open = authenticated = false;
+            callbacks.clear();
+        }
+        if (disconnect) {
+            disconnect(reason);
+        }
+    }
+
+    std::string send(const jsonrpc& request, response_callback callback) {
+        std::shared_ptr<session> s;
+        std::string id = request["id"].get<std::string>();
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            s = ws;
+            if (!s || !open) {
+                throw std::runtime_error("Not connected.");
+            }
+            if (callback) {
+                callbacks.emplace(id, std::move(callback));
+            }
+        }
+        std::string message = request.dump();
+        s->send_message(message, trace::tag_of(request));
+        return id;
+    }
+
+    oems_config config;
+    net::io_context ioc;
+    net::executor_work_guard<net::io_context::executor_type> work;
+    ssl::context ctx{ssl::context::tlsv12_client};
+    std::vector<std::thread> threads;
+
+    // responses and notifications nobody asked for; bounded so they cannot grow
+    RpcQueue inbox{4096, overflow_policy::drop_oldest};
+    RpcQueue feed{4096, overflow_policy::drop_oldest};
+    InstrumentRegistry instruments;
+    OrderManager orders;
+    // stamps responses with "one_way_delay_us"
+    std::shared_ptr<ClockSync> clock = std::make_shared<ClockSync>();
+    notification_callback notification;
+    disconnect_callback disconnect;
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::shared_ptr<session> ws;
+    bool open = false;
+    bool closed = false;
+    bool auth_done = false;
+    bool authenticated = false;
+    std::string auth_id;
+    std::unordered_map<std::string, response_callback> callbacks;
+};
+
+oems_client::oems_client(oems_config config)
+    : impl_(std::make_unique<impl>(std::move(config)))
+{
+}
+
+oems_client::~oems_client() {
+    close();
+}
+
+void oems_client::set_notification_callback(notification_callback callback) {
+    impl_->notification = std::move(callback);
+}
+
+void oems_client::set_disconnect_callback(disconnect_callback callback) {
+    impl_->disconnect = std::move(callback);
+}
+
+bool oems_client::connect(std::chrono::milliseconds timeout) {
+    impl& d = *impl_;
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    heartbeat_config heartbeat;
+    heartbeat.ping_interval = d.config.ping_interval;
+    heartbeat.liveness_timeout = d.config.liveness_timeout;
+    validate_heartbeat_config(heartbeat);
+    std::shared_ptr<session> s;
+    {
+        std::lock_guard<std::mutex> lock(d.mtx);
+        if (d.closed) {
+            throw std::runtime_error("Client is closed.");
+        }
+        if (d.ws) {
+            throw std::runtime_error("Already connected.");
+        }
+        s = d.ws = std::make_shared<session>(d.ioc, d.ctx, d.inbox, d.feed);
+        d.open = d.auth_done = d.authenticated = false;
+    }
+    s->set_heartbeat_config(heartbeat);
+    s->set_clock_sync(d.clock);
+    s->set_verbose(d.config.verbose);
+    s->set_response_handler([&d](session& s, const json& response) {
+        return d.on_response(s, response);
+    });
+    s->set_notification_handler([&d](const json& j) {
+        return d.on_notification(j);
+    });
+    s->set_failover_handler([&d](session& lost, const std::string& reason) {
+        d.on_failover(lost, reason);
+    });
+    s->set_open_handler([&d](session& s) {
+        std::string message = d.instruments.make_refresh_request().dump();
+        s.send_message(message);
+        std::lock_guard<std::mutex> lock(d.mtx);
+        d.open = true;
+        d.cv.notify_all();
+    });
+    s->run(d.config.host.c_str(), d.config.port.c_str(), d.config.endpoint.c_str());
+
+    std::unique_lock<std::mutex> lock(d.mtx);
+    if (!d.cv.wait_until(lock, deadline, [&d] { return d.open; })) {
+        return false;
+    }
+    if (d.config.client_id.empty()) {
+        return true;
+    }
+
+    jsonrpc j("public/auth");
+    j["params"] = {
+        {"grant_type", "client_credentials"},
+        {"client_id", d.config.client_id},
+        {"client_secret", d.config.client_secret}
+    };
+    d.auth_id = j["id"].get<std::string>();
+    std::string message = j.dump();
+    s->send_message(message);
+    return d.cv.wait_until(lock, deadline, [&d] { return d.auth_done; }) && d.authenticated;
+}
+
+bool oems_client::connected() const {
+    std::lock_guard<std::mutex> lock(impl_->mtx);
+    return impl_->open;
+}
+
+bool oems_client::authenticated() const {
+    std::lock_guard<std::mutex> lock(impl_->mtx);
+    return impl_->authenticated;
+}
+
+std::string oems_client::place(const order_entry& order, response_callback callback) {
+    validate_order_entry(order, impl_->instruments);
+    jsonrpc j = make_order_request(order);
+    impl_->orders.track_request(j);
+    return impl_->send(j, std::move(callback));
+}
+
+std::string oems_client::cancel(const std::string& order_id, response_callback callback) {
+    if (order_id.empty()) {
+        throw std::invalid_argument("Missing 'order_id'.");
+    }
+    jsonrpc j("private/cancel");
+    j["params"] = {
+        {"order_id", order_id},
+    };
+    impl_->orders.track_request(j);
+    return impl_->send(j, std::move(callback));
+}
+
+std::string oems_client::edit(const std::string& order_id, double amount, std::optional<double> price,
+                              response_callback callback) {
+    if (order_id.empty()) {
+        throw std::invalid_argument("Missing 'order_id'.");
+    }
+    auto tracked = impl_->orders.find(order_id);
+    const instrument_scale scale = impl_->instruments.ticks().lookup(tracked ? tracked->instrument : no_symbol);
+    require_on_lot(scale, amount, "amount");
+    if (price) {
+        require_on_tick(scale, *price, "price");
+    }
+    jsonrpc j = make_edit_request(order_id, amount, price);
+    impl_->orders.track_request(j);
+    return impl_->send(j, std::move(callback));
+}
+
+std::string oems_client::subscribe(const std::vector<std::string>& channels, response_callback callback) {
+    if (channels.empty()) {
+        throw std::invalid_argument("Missing channels.");
+    }
+    jsonrpc j("private/subscribe");
+    j["params"] = {
+        {"channels", channels}
+    };
+    return impl_->send(j, std::move(callback));
+}
+
+std::string oems_client::unsubscribe(const std::vector<std::string>& channels, response_callback callback) {
+    if (channels.empty()) {
+        throw std::invalid_argument("Missing channels.");
+    }
+    jsonrpc j("private/unsubscribe");
+    j["params"] = {
+        {"channels", channels}
+    };
+    return impl_->send(j, std::move(callback));
+}
+
+void oems_client::close() {
+    impl& d = *impl_;
+    std::shared_ptr<session> s;
+    {
+        std::lock_guard<std::mutex> lock(d.mtx);
+        s = std::move(d.ws);
+        d.open = false;
+        d.closed = true;
+    }
+    if (s) {
+        s->close_websocket();
+    }
+    d.work.reset();
+    d.ioc.stop();
+    for (auto& t : d.threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+}